@@ -0,0 +1,23 @@
+#ifndef _ATTR_CATALOG_UTILITY_H_
+#define _ATTR_CATALOG_UTILITY_H_
+
+#include <string>
+
+using namespace std;
+
+// The attribute catalog is a table of its own, with a row per attribute of
+// every table: the attribute name, the table name, the type, the length and
+// the position of the attribute in the table (negated, minus one, in the row
+// added when the attribute is dropped)
+
+static const string CATALOG_ATTRIBUTES_TABLE_NAME = "CS222_Catalog_Attributes";
+
+static const string CATALOG_ATTR_NAME_STRING = "AttrName";
+static const string CATALOG_TABLE_NAME_STRING = "TableName";
+static const string CATALOG_ATTR_TYPE_STRING = "AttrType";
+static const string CATALOG_ATTR_LENGTH_STRING = "AttrLength";
+static const string CATALOG_POSITION_STRING = "Position";
+
+static const unsigned MAX_ATTR_CATALOG_STRING_COL_LENGTH = 50;	// of the attribute and table names
+
+#endif
@@ -0,0 +1,10 @@
+#include "FileSystemUtility.h"
+
+#include <sys/stat.h>
+
+bool DoesFileExist(const string& fileName)
+{
+	struct stat fileInfo;
+
+	return stat(fileName.c_str(), &fileInfo) == 0;
+}
@@ -0,0 +1,10 @@
+#ifndef _FILE_SYSTEM_UTILITY_H_
+#define _FILE_SYSTEM_UTILITY_H_
+
+#include <string>
+
+using namespace std;
+
+bool DoesFileExist(const string& fileName);
+
+#endif
@@ -0,0 +1,113 @@
+#include "PageUtility.h"
+#include "rm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+///////////////////////////////////////////
+// Constants
+///////////////////////////////////////////
+
+static const unsigned PAGE_FIELDS_SIZE = 4 * sizeof(unsigned);	// freespace, size_freespace, slots, nextPage
+
+///////////////////////////////////////////
+// PageDirectory Class Function Definitions
+///////////////////////////////////////////
+
+PageDirectory::PageDirectory(PF_FileHandle& fileHandle)
+	: _fileHandle(fileHandle), _data(fileHandle.GetPageSize(), 0)
+{
+}
+
+void PageDirectory::ResetData()
+{
+	_data.assign(_data.size(), 0);
+}
+
+RC PageDirectory::LoadDataFromFile()
+{
+	return _fileHandle.ReadPage(0, &_data[0]);
+}
+
+RC PageDirectory::FlushDataToFile()
+{
+	return _fileHandle.WritePage(0, &_data[0]);
+}
+
+unsigned PageDirectory::GetFormatVersion() const
+{
+	unsigned version;
+	memcpy(&version, &_data[0], sizeof(version));
+	return version;
+}
+
+void PageDirectory::SetFormatVersion(unsigned version)
+{
+	memcpy(&_data[0], &version, sizeof(version));
+}
+
+///////////////////////////////////////////
+// Function Definitions
+///////////////////////////////////////////
+
+void RetrievePagePointers(PagePointers& ptrs, char* rec, unsigned pageSize)
+{
+	unsigned* fields = reinterpret_cast<unsigned*>(rec + pageSize - PAGE_FIELDS_SIZE);
+	ptrs.nextPage = fields;
+	ptrs.slots = fields + 1;
+	ptrs.size_freespace = fields + 2;
+	ptrs.freespace = fields + 3;
+
+	ptrs.first = reinterpret_cast<SlotStore*>(fields) - 1;
+	ptrs.last = reinterpret_cast<SlotStore*>(fields) - *ptrs.slots;
+	ptrs.pageSize = pageSize;
+}
+
+void SetNewPagePointers(PagePointers& ptrs, char* rec, unsigned pageSize)
+{
+	memset(rec, 0, pageSize);
+	RetrievePagePointers(ptrs, rec, pageSize);
+
+	*ptrs.freespace = 0;
+	*ptrs.size_freespace = pageSize - PAGE_FIELDS_SIZE;
+	*ptrs.slots = 0;
+	*ptrs.nextPage = 0;
+}
+
+void RearrangePage(PagePointers& ptrs, char*& rec)
+{
+	// the page fields and the slots stay where they are
+	char* newRec = (char*)malloc(ptrs.pageSize);
+	unsigned directoryOffset = reinterpret_cast<char*>(ptrs.last) - rec;
+	memcpy(newRec + directoryOffset, rec + directoryOffset, ptrs.pageSize - directoryOffset);
+
+	PagePointers newPtrs;
+	RetrievePagePointers(newPtrs, newRec, ptrs.pageSize);
+
+	// copy the tuples and tombstones over, one after the other
+	unsigned offset = 0;
+	SlotStore* it = newPtrs.first;
+	for (unsigned i = 0; i < *newPtrs.slots; ++i, --it)
+	{
+		if (IsSlotFree(it, ptrs.pageSize))
+			continue;
+
+		unsigned size = it->slotSize > 0 ? it->slotSize : sizeof(RID);
+		memcpy(newRec + offset, rec + it->slotPtr, size);
+		it->slotPtr = offset;
+		offset += size;
+	}
+	assert(offset <= directoryOffset);
+	memset(newRec + offset, 0, directoryOffset - offset);
+	*newPtrs.freespace = offset;
+
+	free(rec);
+	rec = newRec;
+	ptrs = newPtrs;
+}
+
+bool IsSlotFree(const SlotStore* slot, unsigned pageSize)
+{
+	return slot->slotSize == 0 && slot->slotPtr > pageSize;
+}
@@ -0,0 +1,68 @@
+#ifndef _PAGE_UTILITY_H_
+#define _PAGE_UTILITY_H_
+
+#include "pf.h"
+
+#include <vector>
+
+// Slotted pages: the tuples are stored from the start of the page, the page
+// fields at its end, and the slot directory grows down from the page fields
+// (slot 0 first). A slot with no size is either deleted (slotPtr past the
+// page) or a tombstone, whose slotPtr locates the RID the tuple moved to.
+// Pages are the size of the pages of their table file.
+//
+//  | tuples ... | free | slot n-1 ... slot 0 | nextPage | slots | size_freespace | freespace |
+
+struct SlotStore
+{
+	unsigned slotSize;		// 0 if the slot is deleted or a tombstone
+	unsigned slotPtr;		// offset of the tuple in the page
+};
+
+// locations of the fields of a page in memory
+struct PagePointers
+{
+	unsigned* freespace;		// offset of the contiguous free space after the tuples
+	unsigned* size_freespace;	// free bytes in all (not necessarily contiguous)
+	unsigned* slots;			// number of slots
+	unsigned* nextPage;			// free slot list of the record manager
+	SlotStore* first;			// slot 0
+	SlotStore* last;			// slot (slots - 1); first + 1 if there are no slots
+	unsigned pageSize;
+};
+
+// page 0 of a table file; the free space of the data pages is tracked elsewhere
+// (the table's free space map), so the directory page only keeps the version of
+// the format of the table (0 in files older than the version)
+class PageDirectory
+{
+public:
+	PageDirectory(PF_FileHandle& fileHandle);
+
+	void ResetData();
+	RC LoadDataFromFile();
+	RC FlushDataToFile();
+
+	unsigned GetFormatVersion() const;
+	void SetFormatVersion(unsigned version);
+
+private:
+	PF_FileHandle& _fileHandle;
+	std::vector<char> _data;
+};
+
+// sets ptrs to the fields of the page of pageSize bytes in rec
+void RetrievePagePointers(PagePointers& ptrs, char* rec, unsigned pageSize);
+
+// makes rec an empty page of pageSize bytes, and sets ptrs to its fields
+void SetNewPagePointers(PagePointers& ptrs, char* rec, unsigned pageSize);
+
+// moves the tuples (and tombstones) of the page together, so that all free
+// space is contiguous; the slots keep their numbers. rec is freed and replaced
+// by a new malloc'ed buffer, and ptrs is set to its fields
+void RearrangePage(PagePointers& ptrs, char*& rec);
+
+// whether the slot of a page of pageSize bytes is deleted (neither a tuple nor a tombstone)
+bool IsSlotFree(const SlotStore* slot, unsigned pageSize);
+
+#endif
@@ -0,0 +1,22 @@
+#include "TableUtility.h"
+#include "FileSystemUtility.h"
+
+///////////////////////////////////////////
+// Constants
+///////////////////////////////////////////
+
+static const char TABLE_FILE_EXTENSION[] = ".dbt";
+
+///////////////////////////////////////////
+// Function Definitions
+///////////////////////////////////////////
+
+string getTableFilename(const string& tableName)
+{
+	return tableName + TABLE_FILE_EXTENSION;
+}
+
+bool doesTableExist(const string& tableName)
+{
+	return DoesFileExist(getTableFilename(tableName));
+}
@@ -0,0 +1,14 @@
+#ifndef _TABLE_UTILITY_H_
+#define _TABLE_UTILITY_H_
+
+#include <string>
+
+using namespace std;
+
+// name of the page file that stores a table
+string getTableFilename(const string& tableName);
+
+// whether the table has a page file
+bool doesTableExist(const string& tableName);
+
+#endif
@@ -0,0 +1,48 @@
+#include "TupleItem.h"
+
+#include <string.h>
+
+TupleItem::TupleItem(const string& value)
+{
+	// 4 bytes of length, then the characters
+	unsigned length = value.size();
+	_data.resize(sizeof(length) + length);
+	memcpy(&_data[0], &length, sizeof(length));
+	memcpy(&_data[sizeof(length)], value.data(), length);
+}
+
+TupleItem::TupleItem(int value)
+	: _data(sizeof(value))
+{
+	memcpy(&_data[0], &value, sizeof(value));
+}
+
+TupleItem::TupleItem(unsigned value)
+	: _data(sizeof(value))
+{
+	memcpy(&_data[0], &value, sizeof(value));
+}
+
+TupleItem::TupleItem(float value)
+	: _data(sizeof(value))
+{
+	memcpy(&_data[0], &value, sizeof(value));
+}
+
+TupleItem TupleItem::operator+(const TupleItem& rhs) const
+{
+	TupleItem result(*this);
+	result._data.insert(result._data.end(), rhs._data.begin(), rhs._data.end());
+
+	return result;
+}
+
+const void* TupleItem::GetData() const
+{
+	return &_data[0];
+}
+
+unsigned TupleItem::GetSize() const
+{
+	return _data.size();
+}
@@ -0,0 +1,28 @@
+#ifndef _TUPLE_ITEM_H_
+#define _TUPLE_ITEM_H_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// a tuple in the external format, built by concatenating values:
+//  TupleItem(name) + TupleItem(type) + TupleItem(length)
+class TupleItem
+{
+public:
+	TupleItem(const string& value);
+	TupleItem(int value);
+	TupleItem(unsigned value);
+	TupleItem(float value);
+
+	TupleItem operator+(const TupleItem& rhs) const;
+
+	const void* GetData() const;
+	unsigned GetSize() const;
+
+private:
+	vector<char> _data;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "TupleUtility.h"
+
+#include <string.h>
+
+///////////////////////////////////////////
+// Constants
+///////////////////////////////////////////
+
+static const unsigned OFFSET_SIZE = sizeof(unsigned);	// of each entry of the offsets in front of an internal tuple
+
+///////////////////////////////////////////
+// Function Definitions
+///////////////////////////////////////////
+
+unsigned ComputeMaxInternalTupleSize(const vector<Attribute>& attrs)
+{
+	unsigned size = (attrs.size() + 1) * OFFSET_SIZE;
+	for (unsigned i = 0; i < attrs.size(); ++i)
+	{
+		if (attrs[i].type == TypeVarChar)
+			size += attrs[i].length;
+		else if (attrs[i].type == TypeReal)
+			size += TYPE_REAL_SIZE;
+		else
+			size += TYPE_INT_SIZE;
+	}
+
+	return size;
+}
+
+unsigned GetMaxInternalTupleSize(const TableInfo& tableInfo)
+{
+	return tableInfo.maxInternalTupleSize;
+}
+
+void ExternalToInternalTupleFormat(const TableInfo& tableInfo, const void* data, char* intRepr, unsigned& intSize)
+{
+	unsigned numAttrs = tableInfo.attribute.size();
+	const char* dataPtr = reinterpret_cast<const char*>(data);
+	unsigned offset = (numAttrs + 1) * OFFSET_SIZE;
+	for (unsigned i = 0; i < numAttrs; ++i)
+	{
+		memcpy(intRepr + i * OFFSET_SIZE, &offset, OFFSET_SIZE);
+
+		unsigned valueSize;
+		if (tableInfo.attribute[i].type == TypeVarChar)
+		{
+			memcpy(&valueSize, dataPtr, TYPE_VARCHAR_SIZE);
+			dataPtr += TYPE_VARCHAR_SIZE;
+		}
+		else
+			valueSize = tableInfo.attribute[i].type == TypeReal ? TYPE_REAL_SIZE : TYPE_INT_SIZE;
+
+		memcpy(intRepr + offset, dataPtr, valueSize);
+		dataPtr += valueSize;
+		offset += valueSize;
+	}
+	memcpy(intRepr + numAttrs * OFFSET_SIZE, &offset, OFFSET_SIZE);
+
+	intSize = offset;
+}
+
+void InternalToExternalTupleFormat(const TableInfo& tableInfo, const char* intRepr, void* data, unsigned& dataSize)
+{
+	char* dataPtr = reinterpret_cast<char*>(data);
+	dataSize = 0;
+	for (unsigned i = 0; i < tableInfo.attribute.size(); ++i)
+	{
+		unsigned attrSize;
+		GetTupleAttribute(tableInfo, intRepr, i, dataPtr + dataSize, attrSize);
+		dataSize += attrSize;
+	}
+}
+
+void GetTupleAttribute(const TableInfo& tableInfo, const char* intRepr, unsigned attrIndex, void* data, unsigned& dataSize)
+{
+	unsigned start, end;
+	memcpy(&start, intRepr + attrIndex * OFFSET_SIZE, OFFSET_SIZE);
+	memcpy(&end, intRepr + (attrIndex + 1) * OFFSET_SIZE, OFFSET_SIZE);
+	unsigned valueSize = end - start;
+
+	char* dataPtr = reinterpret_cast<char*>(data);
+	dataSize = 0;
+	if (tableInfo.attribute[attrIndex].type == TypeVarChar)
+	{
+		memcpy(dataPtr, &valueSize, TYPE_VARCHAR_SIZE);
+		dataSize = TYPE_VARCHAR_SIZE;
+	}
+	memcpy(dataPtr + dataSize, intRepr + start, valueSize);
+	dataSize += valueSize;
+}
+
+string ExtractString(const void* data)
+{
+	unsigned length;
+	memcpy(&length, data, TYPE_VARCHAR_SIZE);
+
+	return string(reinterpret_cast<const char*>(data) + TYPE_VARCHAR_SIZE, length);
+}
+
+int ExtractInt(const void* data)
+{
+	int value;
+	memcpy(&value, data, TYPE_INT_SIZE);
+
+	return value;
+}
+
+float ExtractReal(const void* data)
+{
+	float value;
+	memcpy(&value, data, TYPE_REAL_SIZE);
+
+	return value;
+}
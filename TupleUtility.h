@@ -0,0 +1,32 @@
+#ifndef _TUPLE_UTILITY_H_
+#define _TUPLE_UTILITY_H_
+
+#include "rm.h"
+
+// Tuples are passed in and out in the external format: the values one after
+// the other, 4 bytes for an int or a real, and for a varchar 4 bytes of
+// length followed by the characters. Pages store them in the internal format,
+// which finds any attribute without going through the ones before it: the
+// offsets at which each value starts (plus the end of the last one), then the
+// values, with no length in front of varchars.
+
+static const unsigned TYPE_INT_SIZE = sizeof(int);
+static const unsigned TYPE_REAL_SIZE = sizeof(float);
+static const unsigned TYPE_VARCHAR_SIZE = sizeof(unsigned);	// the length in front of the characters
+
+// largest internal tuple of the attributes; an external tuple is never larger
+unsigned ComputeMaxInternalTupleSize(const vector<Attribute>& attrs);
+unsigned GetMaxInternalTupleSize(const TableInfo& tableInfo);
+
+void ExternalToInternalTupleFormat(const TableInfo& tableInfo, const void* data, char* intRepr, unsigned& intSize);
+void InternalToExternalTupleFormat(const TableInfo& tableInfo, const char* intRepr, void* data, unsigned& dataSize);
+
+// the attribute at attrIndex of an internal tuple, in the external format
+void GetTupleAttribute(const TableInfo& tableInfo, const char* intRepr, unsigned attrIndex, void* data, unsigned& dataSize);
+
+// values in the external format
+string ExtractString(const void* data);
+int ExtractInt(const void* data);
+float ExtractReal(const void* data);
+
+#endif
@@ -1,34 +1,134 @@
+// 64-bit file offsets on 32-bit platforms as well
+#define _FILE_OFFSET_BITS 64
+
 #include "pf.h"
 #include <stdio.h>
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// asynchronous I/O through io_uring where the kernel headers provide it
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PF_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
 
 ///////////////////////////////////////////
 // Static variables
 ///////////////////////////////////////////
-static const char TAG[] = "PF_HEADER struct tag";
+static const char TAG[] = "PF_HEADER struct tag";			// version 1 files
 static const int TAG_SIZE = sizeof(TAG);
+static const char LARGE_TAG[TAG_SIZE] = "PF_HEADER large tag";	// version 2 and later
+
+static const unsigned VERSION_1 = 1;		// 32-bit page count; data right after the header
+static const unsigned VERSION_LARGE = 2;	// 64-bit page count; header takes up the first page
+static const unsigned CURRENT_VERSION = VERSION_LARGE;
+
+static const char FREE_PAGE_TAG[] = "PF_FREE_PAGE";
+
+static const unsigned MAX_PAGE_SIZE = 16 * PF_PAGE_SIZE;	// 64K with 4K pages
+
+static const unsigned COMPRESSED_FILE = 1;			// PF_Header::flags
+static const unsigned SECTOR_SIZE = 512;			// allocation unit of compressed pages
+static const unsigned MAP_CHUNK_ENTRIES = 4096;		// page map entries per chunk (64 KB)
+static const unsigned MAX_UNSYNCED_PAGES = MAP_CHUNK_ENTRIES;	// moved compressed pages before the file is synced
+
+static const unsigned LZ_MIN_MATCH = 4;
+static const unsigned LZ_HASH_BITS = 12;
+static const unsigned LZ_MAX_OFFSET = 65535;
+
+static const unsigned DEFAULT_BUFFER_POOL_PAGES = 256;	// 1 MB of 4K frames
+static const unsigned INVALID_FRAME = static_cast<unsigned>(-1);
+
+static const unsigned MIN_COLD_PERCENT = 25;		// 2Q: frames kept for pages entering the pool
+static const unsigned GHOST_PERCENT = 50;			// 2Q: evicted cold pages remembered, in frames
+static const unsigned MAX_RING_PERCENT = 25;		// largest access ring, in frames
+
+static const unsigned DEFAULT_MAX_DIRTY_PAGES = 128;	// write-back thresholds
+static const unsigned DEFAULT_MAX_DIRTY_SECONDS = 5;
+
+static const unsigned MIN_EXTENT_PAGES = 64;		// 256 KB
+static const unsigned MAX_EXTENT_PAGES = 16384;		// 64 MB
+
+static const unsigned READ_AHEAD_TRIGGER = 2;		// sequential reads before reading ahead
+static const unsigned MIN_READ_AHEAD_PAGES = 8;
+static const unsigned MAX_READ_AHEAD_PAGES = 256;	// 1 MB
+
+static const unsigned ASYNC_QUEUE_DEPTH = 64;		// requests in flight per ring
+
+static const unsigned MAX_VECTOR_PAGES = 256;		// pages per preadv/pwritev call (within IOV_MAX)
+
+static const unsigned DEFAULT_WRITER_PAGES = 64;		// pages written per background writer round
+static const unsigned WRITER_INTERVAL_MS = 100;			// between background writer rounds
+static const unsigned DEFAULT_CHECKPOINT_SECONDS = 30;
+static const unsigned long long CHECKPOINT_LOG_SIZE = 16ULL << 20;	// log size that triggers a checkpoint
+
+static const char LOG_TAG[] = "PF_LOG";			// write-ahead log files
+static const unsigned LOG_VERSION = 3;		// operation ids in the records
+
+static const unsigned LOG_FILE = 1;			// log records: file id -> file name
+static const unsigned LOG_CREATE = 2;		// file created
+static const unsigned LOG_DESTROY = 3;		// file destroyed
+static const unsigned LOG_PAGE_DELTA = 4;	// bytes changed within a page: old bytes, then new bytes
+static const unsigned LOG_PAGE_IMAGE = 5;	// whole page, appended or written by WritePages()
+static const unsigned LOG_HEADER = 6;		// page counts and free page list: old header, then new header
+static const unsigned LOG_COMMIT = 7;		// end of the operation of the record
+static const unsigned LOG_CHECKPOINT = 8;	// redo start LSN, then the logged files (id, name length, name)
+
+static const unsigned long long NO_LSN = ~0ULL;		// no log records to write back
 
 ///////////////////////////////////////////
 // Class Definitions
 ///////////////////////////////////////////
 
+// on-disk header of page files; it takes up the whole first page of the file
 struct PF_Header
 {
 public:
-	unsigned int num_pages;
+	unsigned int reserved;		// overlaps the page count of version 1 headers
 
 private:
 	char tag[TAG_SIZE];
 
 public:
+	unsigned int version;
+	unsigned long long num_pages;
+	unsigned long long num_free_pages;		// deallocated pages, chained from free_list_head
+	unsigned long long free_list_head;
+	unsigned int page_size;		// 0 in files created before page sizes were configurable
+	unsigned int flags;
+	unsigned int num_map_chunks;	// compressed files; the chunk sectors follow the header
 
 	PF_Header()
 	{
-		strcpy(tag, TAG);
+		strcpy(tag, LARGE_TAG);
 
+		reserved = 0;
+		version = CURRENT_VERSION;
 		num_pages = 0;
+		num_free_pages = 0;
+		free_list_head = 0;
+		page_size = PF_PAGE_SIZE;
+		flags = 0;
+		num_map_chunks = 0;
 	}
 
 	const char* GetTag() const
@@ -37,10 +137,341 @@ public:
 	}
 };
 
-struct PF_FileHandle_Data
+// on-disk header of version 1 page files
+struct PF_Header_V1
+{
+	unsigned int num_pages;
+	char tag[TAG_SIZE];
+};
+
+// where a page of a compressed file is stored; the page map of a file is
+// kept in chunks of MAP_CHUNK_ENTRIES entries. The chunk table is in the
+// header page, which limits a compressed file to
+// (pageSize - sizeof(PF_Header)) / 8 * MAP_CHUNK_ENTRIES pages (about
+// 2 million with 4K pages); appending past that fails
+struct PF_PageExtent
+{
+	unsigned long long sector;
+	unsigned int length;		// stored bytes; the page size if stored uncompressed
+	unsigned int numSectors;	// sectors reserved for the page; 0 if never written
+};
+
+// contents of a deallocated page
+struct PF_FreePage
+{
+	char tag[sizeof(FREE_PAGE_TAG)];
+	unsigned long long next_free_page;	// valid if this is not the last free page
+};
+
+// start of write-ahead log files
+struct PF_LogHeader
+{
+	char tag[sizeof(LOG_TAG)];
+	unsigned int version;
+	unsigned long long base_lsn;	// LSN of the first record in the file
+};
+
+// header of a log record; the record data follows it
+struct PF_LogRecord
+{
+	unsigned int size;			// of the whole record
+	unsigned int checksum;		// of the whole record, computed with this field set to 0
+	unsigned long long lsn;		// log offset of the record
+	unsigned long long operation_id;	// operation the change belongs to; 0 for other records
+	unsigned int type;
+	unsigned int file_id;
+	unsigned long long page_num;
+	unsigned int offset;		// page deltas: first byte changed
+	unsigned int length;		// bytes of data
+};
+
+// identifies a page file independently of the name it was opened with
+struct PF_FileKey
+{
+	dev_t device;
+	ino_t inode;
+
+	bool operator<(const PF_FileKey& rhs) const
+	{
+		if (device != rhs.device)
+			return device < rhs.device;
+		return inode < rhs.inode;
+	}
+
+	bool operator==(const PF_FileKey& rhs) const
+	{
+		return device == rhs.device && inode == rhs.inode;
+	}
+};
+
+// an opened page file; shared by all file handles opened on the same file
+struct PF_File
 {
+	PF_FileKey key;
 	PF_Header header;
-	FILE* pFile;
+	int fd;
+	bool isDirectIO;			// O_DIRECT; transfers must be page-aligned
+	off_t dataOffset;			// offset of page 0
+	unsigned pageSize;
+	unsigned refCount;
+	PageNum numAllocatedPages;	// pages the file has room for (preallocated extents included)
+
+	// compressed files: location of every page, and the sectors not in use
+	bool isCompressed;
+	std::vector<PF_PageExtent> pageMap;
+	std::vector<unsigned long long> mapChunks;		// first sector of each page map chunk
+	std::map<unsigned long long, unsigned long long> freeSectors;	// first sector -> number of sectors
+	unsigned long long endSector;		// first sector past the stored data
+	std::map<PageNum, PF_PageExtent> unsyncedPages;	// moved pages -> where the page map on disk still has them
+
+	// write-ahead logging; changes are logged while a log is open and RM enables it
+	std::string name;			// as opened; identifies the file in the log
+	bool isLogged;
+	unsigned logFileId;
+	PF_Header loggedHeader;		// as of the last header record; the old values of the next one
+
+	// deallocated pages; loaded from the free page chain when first needed
+	bool isFreePageSetLoaded;
+	std::set<PageNum> freePages;
+
+	// write-back state
+	bool isHeaderDirty;
+	unsigned numDirtyPages;
+	time_t firstDirtyTime;		// when the oldest unwritten change was made
+	unsigned long long headerRecLSN;	// first log record of the unwritten header changes
+	unsigned numWritesInProgress;		// pages being written by the background writer
+
+	PF_IOStats* stats;			// kept by file name across opens, until ResetIOStats() or DestroyFile()
+
+	bool HasPendingWrites() const
+	{
+		return isHeaderDirty || numDirtyPages > 0;
+	}
+
+	void SetHeaderDirty()
+	{
+		if (!HasPendingWrites())
+			firstDirtyTime = time(NULL);
+		isHeaderDirty = true;
+	}
+};
+
+// batches of positional page reads and writes kept in flight together; uses
+// io_uring when available and falls back to synchronous pread/pwrite otherwise
+class PF_AsyncIO
+{
+public:
+	PF_AsyncIO(unsigned queueDepth);
+	~PF_AsyncIO();
+
+	bool Submit(bool isWrite, int fd, void* data, size_t size, off_t offset);
+	unsigned Reap(bool isWaiting);
+	bool WaitAll();
+	unsigned GetNumPending() const { return _numQueued + _numInFlight; }
+
+private:
+	bool Enter(unsigned minComplete);
+
+	int _ringFd;
+	unsigned _numEntries;
+	unsigned _numQueued;		// in the submission queue, not yet passed to the kernel
+	unsigned _numInFlight;		// passed to the kernel, not yet reaped
+	bool _hasFailed;			// a request failed since the last WaitAll()
+
+#ifdef PF_HAS_IO_URING
+	void* _sqRing;
+	size_t _sqRingSize;
+	void* _cqRing;
+	size_t _cqRingSize;
+	io_uring_sqe* _sqes;
+	size_t _sqesSize;
+	unsigned* _sqTail;
+	unsigned* _sqMask;
+	unsigned* _sqArray;
+	unsigned* _cqHead;
+	unsigned* _cqTail;
+	unsigned* _cqMask;
+	io_uring_cqe* _cqes;
+	unsigned long long _lastRequestId;
+	std::map<unsigned long long, size_t> _requestSizes;	// expected result of each request not yet reaped
+#endif
+};
+
+// write-ahead log shared by all logged files. Appended records are kept in
+// memory until a flush; a flush writes and syncs everything appended so far,
+// so callers that wait for one while it is in progress share the next one
+// (group commit)
+class PF_Log
+{
+public:
+	PF_Log();
+	~PF_Log();
+
+	bool Open(const char* fileName);
+	bool Close();
+	bool ReadRecords(unsigned long long lsn, std::vector<char>& records);
+
+	unsigned long long Append(unsigned type, unsigned long long operationId, unsigned fileId,
+		unsigned long long pageNum, unsigned offset, const void* data, unsigned length);
+	bool Flush(unsigned long long lsn);
+	bool FlushAll();
+	bool Reset();
+	bool Truncate(unsigned long long lsn);
+
+	unsigned long long GetEndLSN();
+	unsigned long long GetSize();
+
+private:
+	bool WriteHeader(int fd, unsigned long long baseLSN);
+
+	std::string _fileName;
+	int _fd;
+	pthread_mutex_t _mutex;
+	pthread_cond_t _flushDone;
+	bool _isFlushing;
+
+	unsigned long long _baseLSN;		// LSN of the first record in the file
+	unsigned long long _bufferLSN;		// LSN of the first buffered byte
+	unsigned long long _flushedLSN;		// records before it are durable
+	std::vector<char> _buffer;			// records not written yet
+};
+
+// frames recycled by the page misses of one file handle (e.g., a scan), so
+// that they do not displace the pages cached for everybody else
+struct PF_AccessRing
+{
+	unsigned maxFrames;				// 0 if the handle has no ring
+	std::vector<unsigned> frames;	// frames loaded through the ring, in loading order
+	unsigned next;					// slot of the frame to recycle next once the ring is full
+};
+
+struct PF_FileHandle_Data
+{
+	PF_File* file;
+	PF_AsyncIO* asyncIO;		// created on first asynchronous request
+	PF_AccessRing ring;
+
+	PF_AccessRing* GetRing()
+	{
+		return ring.maxFrames > 0 ? &ring : NULL;
+	}
+
+	// sequential read detection
+	bool isReadAheadEnabled;
+	PageNum lastPageRead;
+	unsigned numSequentialReads;
+	PageNum readAheadEnd;		// first page past the pages already requested
+	unsigned readAheadPages;	// size of the next read-ahead request
+
+	// direct I/O read-ahead in flight; its frames stay pinned until it is reaped
+	PF_AsyncIO* readAheadIO;
+	std::vector<unsigned> readAheadFrames;
+
+	void ResetReadAhead()
+	{
+		lastPageRead = static_cast<PageNum>(-1);
+		numSequentialReads = 0;
+		readAheadEnd = 0;
+		readAheadPages = MIN_READ_AHEAD_PAGES;
+	}
+};
+
+// a buffer pool frame holding one cached page
+struct PF_Frame
+{
+	PF_FileKey key;
+	PageNum pageNum;
+	PF_File* file;			// file to write back to; only valid while the frame is dirty
+	unsigned pinCount;
+	bool isValid;			// frame holds a page (and is in the hash table)
+	bool isDirty;
+	bool isReferenced;		// clock bit of the hot set
+	bool isHot;				// referenced again after it was evicted from the cold set
+	unsigned long long coldEntry;	// entry in the cold queue while in the cold set, otherwise 0
+	bool isWriteInProgress;	// a copy of the page is being written with the pool lock released
+	bool isReadInProgress;	// the page is being read in with the pool lock released; pinned meanwhile
+	PF_AccessRing* ring;	// ring the page was loaded through; not remembered when evicted
+	PF_FileHandle_Data* readAhead;	// handle reading the page ahead; NULL once the read is reaped
+	unsigned long long recLSN;	// first log record of the unwritten changes (NO_LSN if unlogged)
+	char* pinnedData;		// logged files: contents as of the last logged change of a pinned page
+	unsigned nextInBucket;	// hash chain
+	char* data;
+	unsigned dataSize;		// page size of the buffer; reallocated for pages of other sizes
+};
+
+// fixed-size pool of page frames shared by all opened page files. Replacement
+// is 2Q: new pages enter the cold set, which is evicted first, first in first
+// out, and only pages referenced again after their eviction from it
+// enter the hot set, which is evicted by the clock. Pages read once by a scan
+// therefore never displace the pages in use all along
+class PF_BufferPool
+{
+public:
+	PF_BufferPool(unsigned numFrames);
+	~PF_BufferPool();
+
+	unsigned GetNumFrames() const { return _frames.size(); }
+
+	unsigned FindFrame(const PF_FileKey& key, PageNum pageNum);
+	bool HasFrame(const PF_FileKey& key, PageNum pageNum) const;
+	unsigned AllocateFrame(const PF_FileKey& key, PageNum pageNum, unsigned pageSize, PF_AccessRing* ring,
+		bool isUnlockAllowed);
+	void ReleaseFrame(unsigned frameIndex);
+	void ReleaseRing(PF_AccessRing& ring);
+	void MarkFrameDirty(unsigned frameIndex, PF_File* file, unsigned long long recLSN);
+	void MarkFrameClean(unsigned frameIndex);
+	PF_Frame& GetFrame(unsigned frameIndex) { return _frames[frameIndex]; }
+
+	bool FlushFile(PF_File* file);
+	bool FlushAll();
+	bool IsAnyFramePinned() const;
+	void InvalidateFile(const PF_FileKey& key);
+
+	bool WriteDirtyPages(unsigned maxPages);
+	void WaitForWrites(const PF_File* file);
+	unsigned long long GetMinRecLSN() const;
+
+private:
+	typedef std::pair<PF_FileKey, PageNum> PageId;
+
+	unsigned ComputeBucket(const PF_FileKey& key, PageNum pageNum) const;
+	unsigned FindVictim();
+	unsigned FindColdVictim();
+	unsigned FindHotVictim();
+	unsigned FindRingVictim(PF_AccessRing& ring, unsigned& ringSlot);
+	bool FlushFrame(unsigned frameIndex, bool isUnlockAllowed);
+	void RemoveFromBucket(unsigned frameIndex);
+	void RemoveFromSets(unsigned frameIndex);
+
+	std::vector<PF_Frame> _frames;
+	std::vector<unsigned> _buckets;
+	unsigned _freeHand;
+	unsigned _hotHand;
+	unsigned _numCold;
+	unsigned _numHot;
+	unsigned _numWritesInProgress;
+
+	// frames of the cold set (2Q "A1in"), oldest first; entries of frames that
+	// left the set since are skipped
+	std::deque<std::pair<unsigned, unsigned long long> > _coldQueue;	// frame, entry number
+	unsigned long long _numColdEntries;
+
+	// pages recently evicted from the cold set (2Q "A1out"), oldest first;
+	// entries replaced by a later eviction of the same page are skipped
+	std::map<PageId, unsigned long long> _ghosts;		// page -> eviction number
+	std::deque<std::pair<PageId, unsigned long long> > _ghostOrder;
+	unsigned long long _numColdEvictions;
+};
+
+// the lock over the buffer pool, the opened files and the settings below;
+// every PF_Manager and PF_FileHandle function holds it. Nested calls on the
+// same thread only count the depth, so the mutex is held at most once and
+// waiting on a condition releases it completely
+class PF_PoolLock
+{
+public:
+	PF_PoolLock();
+	~PF_PoolLock();
 };
 
 ///////////////////////////////////////////
@@ -48,11 +479,96 @@ struct PF_FileHandle_Data
 ///////////////////////////////////////////
 PF_Manager* PF_Manager::_pf_manager = 0;
 
+static PF_BufferPool* bufferPool = NULL;
+static std::map<PF_FileKey, PF_File*> openedFiles;
+
+static PF_AsyncIO* writeBackIO = NULL;
+
+static PF_Log* writeAheadLog = NULL;
+static unsigned lastLogFileId = 0;
+static unsigned long long lastOperationId = 0;
+static std::map<unsigned long long, unsigned long long> activeOperations;	// operation id -> LSN of its first record
+static __thread unsigned long long threadOperationId = 0;	// operation of the calling thread, if still active
+
+static bool isWriteBackEnabled = false;
+static unsigned maxDirtyPages = DEFAULT_MAX_DIRTY_PAGES;
+static unsigned maxDirtySeconds = DEFAULT_MAX_DIRTY_SECONDS;
+
+static PF_IOStats globalStats;
+static std::map<std::string, PF_IOStats> fileStats;
+
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread unsigned poolLockDepth = 0;
+static pthread_cond_t writesDone = PTHREAD_COND_INITIALIZER;		// page reads and writes without the lock, or a checkpoint, completed
+
+static pthread_t writerThread;
+static pthread_cond_t writerWakeup = PTHREAD_COND_INITIALIZER;
+static bool isWriterRunning = false;
+static bool isWriterStopping = false;
+static unsigned writerPages = DEFAULT_WRITER_PAGES;
+static unsigned checkpointSeconds = DEFAULT_CHECKPOINT_SECONDS;
+static time_t lastCheckpointTime = 0;
+static bool isCheckpointing = false;
+
 ///////////////////////////////////////////
 // Helper Function Declarations
 ///////////////////////////////////////////
 
 bool DoesFileExist(const char* fileName);
+bool GetFileKey(const char* fileName, PF_FileKey& key);
+PF_File* OpenPageFile(const char* fileName, bool isDirectIO);
+RC ClosePageFile(PF_File* file);
+bool ReadFromFile(int fd, void* data, size_t size, off_t offset);
+bool WriteToFile(int fd, const void* data, size_t size, off_t offset);
+bool ReadHeaderFromFile(int fd, PF_Header& header, off_t& dataOffset);
+bool WriteHeaderToFile(PF_File* file);
+bool IsValidPageSize(unsigned pageSize);
+bool IsPageAligned(const void* data);
+char* GetBouncePage();
+off_t GetPageOffset(const PF_File* file, PageNum pageNum);
+RC ReadPageFromFile(PF_File* file, PageNum pageNum, void* data);
+RC WritePageToFile(PF_File* file, PageNum pageNum, const void* data);
+RC ReadPageThroughPool(PF_File* file, PageNum pageNum, void* data, PF_AccessRing* ring, bool isUnlockAllowed);
+RC WritePageThroughPool(PF_File* file, PageNum pageNum, const void* data, PF_AccessRing* ring, bool isUnlockAllowed);
+RC LoadFrame(PF_File* file, unsigned frameIndex, bool isReading);
+RC AppendPageToFile(PF_File* file, const void* data, PageNum& pageNum, PF_AccessRing* ring);
+void CompleteReadAhead(PF_FileHandle_Data& handle, bool isWaiting);
+RC UpdateHeader(PF_File* file);
+bool LoadFreePageSet(PF_File* file);
+bool TransferVector(int fd, bool isWrite, struct iovec* iov, int iovcnt, off_t offset);
+RC TransferPageRuns(PF_File* file, bool isWrite, const std::vector<std::pair<PageNum, unsigned> >& pages, void* const* data);
+RC AllocateExtent(PF_File* file, PageNum numPages);
+unsigned CompressPage(const char* src, unsigned size, char* dst, unsigned capacity);
+bool DecompressPage(const char* src, unsigned length, char* dst, unsigned size);
+char* GetCompressionBuffer();
+bool LoadPageMap(PF_File* file);
+RC ReadCompressedPage(PF_File* file, PageNum pageNum, void* data);
+RC WriteCompressedPage(PF_File* file, PageNum pageNum, const void* data);
+bool WritePageMapEntries(PF_File* file);
+RC SyncPageFile(PF_File* file);
+unsigned long long AllocateSectors(PF_File* file, unsigned long long numSectors);
+void FreeSectors(PF_File* file, unsigned long long sector, unsigned long long numSectors);
+RC FlushFileData(PF_File* file);
+RC FlushFileDataOverThreshold(PF_File* file);
+bool IsWriteDeferred(const PF_File* file);
+unsigned long long GetLogEndLSN(const PF_File* file);
+void* RunBackgroundWriter(void*);
+RC StopBackgroundWriter();
+void WriteDirtyHeaders();
+RC TakeCheckpoint();
+unsigned long long BeginOperation();
+unsigned long long AppendCommitRecord(PF_Log* log);
+void LogPageChange(PF_File* file, PageNum pageNum, const char* oldData, const char* newData);
+void LogHeaderChange(PF_File* file);
+unsigned ComputeChecksum(const char* data, size_t size);
+size_t GetValidLogSize(const std::vector<char>& data, unsigned long long baseLSN);
+bool RecoverFromLog(PF_Log* log);
+RC ApplyLogRecord(PF_File* file, const PF_LogRecord& record, const char* data, bool isUndo);
+void FlushAllFilesAtExit();
+unsigned long long GetMicroseconds();
+void RecordLatency(PF_File* file, PF_LatencyStats PF_IOStats::*operation, unsigned long long startTime);
+void CountPageIO(PF_File* file, bool isWrite, unsigned long long numPages);
+bool IsFileStatsInUse(const PF_IOStats* stats);
 
 ///////////////////////////////////////////
 // Class Function Definitions
@@ -62,89 +578,141 @@ PF_Manager* PF_Manager::Instance()
 {
     if(!_pf_manager)
         _pf_manager = new PF_Manager();
-    
-    return _pf_manager;    
+
+    return _pf_manager;
 }
 
 
 PF_Manager::PF_Manager()
 {
+	if (bufferPool == NULL)
+	{
+		bufferPool = new PF_BufferPool(DEFAULT_BUFFER_POOL_PAGES);
+
+		// files kept open until exit must not lose deferred writes
+		atexit(FlushAllFilesAtExit);
+	}
 }
 
 
 PF_Manager::~PF_Manager()
 {
+	StopBackgroundWriter();
+
+	PF_PoolLock lock;
+	if (bufferPool != NULL)
+	{
+		bufferPool->FlushAll();
+		delete bufferPool;
+		bufferPool = NULL;
+	}
 }
 
-    
+
 RC PF_Manager::CreateFile(const char *fileName)
 {
+	return CreateFile(fileName, PF_PAGE_SIZE);
+}
+
+
+RC PF_Manager::CreateFile(const char *fileName, unsigned pageSize)
+{
+	return CreateFile(fileName, pageSize, false);
+}
+
+
+RC PF_Manager::CreateFile(const char *fileName, unsigned pageSize, bool isCompressed)
+{
+	PF_PoolLock lock;
+
+	if (!IsValidPageSize(pageSize))
+		return -1;	// return error
+
 	// check if file exists
 	if (DoesFileExist(fileName))
 		return -1;	// return error
 
 	// attempt to create file
-	FILE * pFile;
-	pFile = fopen (fileName, "wb");
-	if (pFile == NULL)
+	int fd = open(fileName, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
 		return -1;	// return error
 	else
 	{
-		// write header
-		fseek(pFile, 0, SEEK_SET);
+		// write header page
+		std::vector<char> headerPage(pageSize, 0);
 		PF_Header header;
-		int amt_written = fwrite(&header, 1, sizeof(header), pFile);
-		assert(amt_written == sizeof(header));
+		header.page_size = pageSize;
+		header.flags = isCompressed ? COMPRESSED_FILE : 0;
+		memcpy(&headerPage[0], &header, sizeof(header));
+		bool isWritten = WriteToFile(fd, &headerPage[0], pageSize, 0);
+		assert(isWritten);
 
 		// close file
-		fclose(pFile);
-		pFile = NULL;
+		close(fd);
 	}
 
+	// drop cached pages of a previously removed file that had the same inode
+	PF_FileKey key;
+	if (GetFileKey(fileName, key))
+		bufferPool->InvalidateFile(key);
+
+	// changes logged for an earlier file of the same name do not apply to this one
+	if (writeAheadLog != NULL)
+		writeAheadLog->Append(LOG_CREATE, 0, 0, 0, 0, fileName, strlen(fileName));
+
     return 0;
 }
 
 
 RC PF_Manager::DestroyFile(const char *fileName)
 {
+	PF_PoolLock lock;
+
 	if (fileName == NULL)
 		return -1;
 
+	// cached pages of the file are no longer valid
+	PF_FileKey key;
+	if (GetFileKey(fileName, key))
+		bufferPool->InvalidateFile(key);
+
+	if (writeAheadLog != NULL)
+		writeAheadLog->Append(LOG_DESTROY, 0, 0, 0, 0, fileName, strlen(fileName));
+
+	// the counters of a file still open go on until it is closed
+	std::map<std::string, PF_IOStats>::iterator statsItr = fileStats.find(fileName);
+	if (statsItr != fileStats.end() && !IsFileStatsInUse(&statsItr->second))
+		fileStats.erase(statsItr);
+
     return remove(fileName);
 }
 
 
 RC PF_Manager::OpenFile(const char *fileName, PF_FileHandle &fileHandle)
 {
+	return OpenFile(fileName, fileHandle, false);
+}
+
+
+RC PF_Manager::OpenFile(const char *fileName, PF_FileHandle &fileHandle, bool isDirectIO)
+{
+	PF_PoolLock lock;
+
 	// check that fileHandle is already created
 	if (&fileHandle == NULL)
 		return -1;	// return error
 
 	// check that fileHandle is not already a handle for another opened file
-	if (fileHandle._pimpl->pFile != NULL)
-		return -1;	// return error
-
-	// check that file exists
-	FILE* pFile;
-	pFile = fopen(fileName, "r+b");
-	if (pFile == NULL)
+	if (fileHandle._pimpl->file != NULL)
 		return -1;	// return error
 
-	// check that the file is a valid page file
-	int seek_result = fseek(pFile, 0, SEEK_SET);
-	assert(seek_result == 0);
-	PF_Header header;
-	int amt_read = fread(&header, 1, sizeof(header), pFile);
-	if ((amt_read != sizeof(header))
-		|| (strcmp(header.GetTag(), TAG) != 0))
-	{
-		fclose(pFile);
+	PF_File* file = OpenPageFile(fileName, isDirectIO);
+	if (file == NULL)
 		return -1;	// return error
-	}
 
 	// assign opened file to fileHandle
-	fileHandle._pimpl->header = header;
-	fileHandle._pimpl->pFile = pFile;
+	fileHandle._pimpl->file = file;
+	fileHandle._pimpl->ResetReadAhead();
 
     return 0;
 }
@@ -152,134 +720,3975 @@ RC PF_Manager::OpenFile(const char *fileName, PF_FileHandle &fileHandle)
 
 RC PF_Manager::CloseFile(PF_FileHandle &fileHandle)
 {
+	PF_PoolLock lock;
+
 	// check that fileHandle is not NULL
 	if (&fileHandle == NULL)
 		return -1;
 
-	// close file
-	int result = fclose(fileHandle._pimpl->pFile);
-	if (result != EOF)
-		fileHandle._pimpl->pFile = NULL;
+	PF_File* file = fileHandle._pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	// complete the asynchronous requests of the handle
+	int result = 0;
+	if (fileHandle._pimpl->asyncIO != NULL)
+	{
+		if (!fileHandle._pimpl->asyncIO->WaitAll())
+			result = -1;
+		delete fileHandle._pimpl->asyncIO;
+		fileHandle._pimpl->asyncIO = NULL;
+	}
+
+	// pages read ahead are cached like any other (or dropped if the read failed)
+	CompleteReadAhead(*fileHandle._pimpl, true);
+	delete fileHandle._pimpl->readAheadIO;
+	fileHandle._pimpl->readAheadIO = NULL;
+
+	bufferPool->ReleaseRing(fileHandle._pimpl->ring);
+	fileHandle._pimpl->file = NULL;
+	if (ClosePageFile(file) != 0)
+		result = -1;
 
     return result;
 }
 
 
-PF_FileHandle::PF_FileHandle()
+RC PF_Manager::SetBufferPoolSize(unsigned numPages)
 {
-	_pimpl = new PF_FileHandle_Data();
-	_pimpl->pFile = NULL;
+	PF_PoolLock lock;
+
+	if (numPages == 0)
+		return -1;
+
+	// frames pinned by a read-ahead are unpinned once it is reaped
+	for (unsigned i = 0; i < bufferPool->GetNumFrames(); ++i)
+	{
+		if (bufferPool->GetFrame(i).readAhead != NULL)
+			CompleteReadAhead(*bufferPool->GetFrame(i).readAhead, true);
+	}
+
+	// pinned pages cannot be moved to a new pool
+	if (bufferPool->IsAnyFramePinned())
+		return -1;
+
+	if (!bufferPool->FlushAll())
+		return -1;
+
+	delete bufferPool;
+	bufferPool = new PF_BufferPool(numPages);
+
+	return 0;
 }
- 
 
-PF_FileHandle::~PF_FileHandle()
+
+unsigned PF_Manager::GetBufferPoolSize() const
 {
-	assert(_pimpl != NULL);
+	PF_PoolLock lock;
+
+	return bufferPool->GetNumFrames();
+}
+
+
+RC PF_Manager::SetWriteBackMode(bool isEnabled, unsigned maxPages, unsigned maxSeconds)
+{
+	PF_PoolLock lock;
+
+	if (isEnabled && maxPages == 0)
+		return -1;
 
-	if (_pimpl->pFile != NULL)
+	// switching back to write-through; write out everything that was deferred
+	RC result = 0;
+	if (!isEnabled)
 	{
-		fclose(_pimpl->pFile );
-		_pimpl->pFile = NULL;
+		std::map<PF_FileKey, PF_File*>::iterator itr;
+		for (itr = openedFiles.begin(); itr != openedFiles.end(); ++itr)
+		{
+			if (FlushFileData(itr->second) != 0)
+				result = -1;
+		}
 	}
 
-	delete _pimpl;
+	isWriteBackEnabled = isEnabled;
+	maxDirtyPages = maxPages;
+	maxDirtySeconds = maxSeconds;
+
+	return result;
 }
 
 
-RC PF_FileHandle::ReadPage(PageNum pageNum, void *data)
+RC PF_Manager::OpenLog(const char *logFileName)
 {
-	// check that a file is opened
-	if (_pimpl->pFile == NULL)
-		return -1;
+	PF_PoolLock lock;
 
-	// set read pointer
-	PF_Header& header = _pimpl->header;
-	if (pageNum >= header.num_pages)
-		return -1;	// return error
-	const int HEADER_SIZE = sizeof(header);
-	int page_offset = pageNum * PF_PAGE_SIZE;
-	fseek(_pimpl->pFile, HEADER_SIZE + page_offset, SEEK_SET);
+	if (writeAheadLog != NULL)
+		return -1;	// a log is already open
 
-	// read page
-	fread(data, 1, PF_PAGE_SIZE, _pimpl->pFile);
+	PF_Log* log = new PF_Log();
+	if (!log->Open(logFileName))
+	{
+		delete log;
+		return -1;
+	}
 
-    return 0;
+	// bring the logged files up to date after an unclean shutdown; the log
+	// starts out empty after that
+	if (!RecoverFromLog(log) || !log->Reset())
+	{
+		log->Close();
+		delete log;
+		return -1;
+	}
+
+	writeAheadLog = log;
+	activeOperations.clear();
+	return 0;
 }
 
 
-RC PF_FileHandle::WritePage(PageNum pageNum, const void *data)
+RC PF_Manager::CloseLog()
 {
-	// check that a file is opened
-	if (_pimpl->pFile == NULL)
+	PF_PoolLock lock;
+
+	if (writeAheadLog == NULL)
 		return -1;
 
-	// check if the page already exists
-	PF_Header& header = _pimpl->header;
-	if (pageNum >= header.num_pages)
+	// the background writer and checkpoints use the log until they are done
+	while (isCheckpointing)
+		pthread_cond_wait(&writesDone, &poolMutex);
+	bufferPool->WaitForWrites(NULL);
+
+	// write out and sync the logged files; the log is not needed after that
+	RC result = 0;
+	std::map<PF_FileKey, PF_File*>::iterator itr;
+	for (itr = openedFiles.begin(); itr != openedFiles.end(); ++itr)
 	{
-		return -1;	// return error
+		PF_File* file = itr->second;
+		if (!file->isLogged)
+			continue;
+
+		if (FlushFileData(file) != 0 || SyncPageFile(file) != 0)
+			result = -1;
+		file->isLogged = false;
 	}
 
-	// write page
-	const int HEADER_SIZE = sizeof(header);
-	int page_offset = pageNum * PF_PAGE_SIZE;
-	fseek(_pimpl->pFile, HEADER_SIZE + page_offset, SEEK_SET);
-	int amt_written = fwrite(data, 1, PF_PAGE_SIZE, _pimpl->pFile);
-	if (amt_written != PF_PAGE_SIZE)
-		return -1;	// return error
+	// the records are replayed at the next OpenLog() if the files could not be synced
+	if (result == 0 && !writeAheadLog->Reset())
+		result = -1;
+	if (!writeAheadLog->Close())
+		result = -1;
 
-	// flush write operations
-	int flush_result = fflush(_pimpl->pFile);
-	assert(flush_result == 0);
+	delete writeAheadLog;
+	writeAheadLog = NULL;
 
-    return 0;
+	return result;
 }
 
 
-RC PF_FileHandle::AppendPage(const void *data)
+RC PF_Manager::Commit()
 {
-	// check that a file is opened
-	if (_pimpl->pFile == NULL)
+	PF_Log* log;
+	unsigned long long lsn;
+	{
+		PF_PoolLock lock;
+		log = writeAheadLog;
+		if (log == NULL)
+			return 0;
+
+		lsn = AppendCommitRecord(log);
+	}
+
+	// the operation is durable once its commit record is; the other threads
+	// go on meanwhile (and commit along with it)
+	return log->Flush(lsn) ? 0 : -1;
+}
+
+
+RC PF_Manager::Abort()
+{
+	PF_PoolLock lock;
+
+	// without a log the changes cannot be undone
+	PF_Log* log = writeAheadLog;
+	if (log == NULL)
 		return -1;
 
-	// write page
-	PF_Header& header = _pimpl->header;
-	fseek(_pimpl->pFile, 0, SEEK_END);
-	int amt_written = fwrite(data, 1, PF_PAGE_SIZE, _pimpl->pFile);
-	if (amt_written != PF_PAGE_SIZE)
-		return -1;	// return error
+	std::map<unsigned long long, unsigned long long>::iterator operationItr = activeOperations.find(threadOperationId);
+	if (operationItr == activeOperations.end())
+		return 0;	// no changes since the last commit
+	unsigned long long operationId = threadOperationId;
+	unsigned long long startLSN = operationItr->second;
 
-	// update and write header
-	header.num_pages += 1;
-	fseek(_pimpl->pFile, 0, SEEK_SET);
-	amt_written = fwrite(&header, 1, sizeof(header), _pimpl->pFile);
-	assert(amt_written == sizeof(header));
+	// read the records of the operation back from the log; the other threads
+	// go on while it is flushed
+	pthread_mutex_unlock(&poolMutex);
+	bool isFlushed = log->FlushAll();
+	pthread_mutex_lock(&poolMutex);
+	std::vector<char> records;
+	if (!isFlushed || !log->ReadRecords(startLSN, records))
+		return -1;
+
+	std::vector<size_t> undoRecords;
+	PF_LogRecord record;
+	for (size_t pos = 0; pos < records.size(); pos += record.size)
+	{
+		memcpy(&record, &records[pos], sizeof(record));
+		if (record.operation_id == operationId
+			&& (record.type == LOG_PAGE_DELTA || record.type == LOG_PAGE_IMAGE || record.type == LOG_HEADER))
+			undoRecords.push_back(pos);
+	}
 
-	// flush write operations
-	int flush_result = fflush(_pimpl->pFile);
-	assert(flush_result == 0);
+	// undo, last change first. The undo is logged as more changes of the
+	// operation, which then commits: redo repeats both, and a crash before
+	// the commit record is durable undoes both
+	RC result = 0;
+	for (size_t i = undoRecords.size(); i-- > 0; )
+	{
+		size_t pos = undoRecords[i];
+		memcpy(&record, &records[pos], sizeof(record));
 
-    return 0;
-}
+		PF_File* file = NULL;
+		std::map<PF_FileKey, PF_File*>::iterator fileItr;
+		for (fileItr = openedFiles.begin(); fileItr != openedFiles.end() && file == NULL; ++fileItr)
+		{
+			if (fileItr->second->isLogged && fileItr->second->logFileId == record.file_id)
+				file = fileItr->second;
+		}
 
+		// a file closed since keeps the changes until recovery after a crash
+		if (file == NULL || ApplyLogRecord(file, record, &records[pos + sizeof(record)], true) != 0)
+			result = -1;
+	}
 
-unsigned PF_FileHandle::GetNumberOfPages()
-{
-	// check that a file is opened
-	assert(_pimpl->pFile != NULL);
+	// an operation that could not be undone is left to recovery; the next
+	// changes of the thread start a new one either way
+	if (result == 0)
+	{
+		activeOperations.erase(operationId);
+		log->Append(LOG_COMMIT, operationId, 0, 0, 0, NULL, 0);
+	}
+	threadOperationId = 0;
 
-	return _pimpl->header.num_pages;
+	return result;
 }
 
-///////////////////////////////////////////
-// Helper Function Definitions
-///////////////////////////////////////////
 
-bool DoesFileExist(const char* fileName)
+RC PF_Manager::SetBackgroundWriter(bool isEnabled, unsigned maxPages, unsigned checkpointInterval)
 {
-	struct stat stFileInfo;
+	if (!isEnabled)
+		return StopBackgroundWriter();
 
-	if(stat(fileName, &stFileInfo) == 0) return true;
-	else return false;
+	if (maxPages == 0 || checkpointInterval == 0)
+		return -1;
+
+	PF_PoolLock lock;
+	writerPages = maxPages;
+	checkpointSeconds = checkpointInterval;
+	if (isWriterRunning)
+		return 0;
+
+	// from now on, changes are written back by the writer
+	isWriterStopping = false;
+	lastCheckpointTime = time(NULL);
+	if (pthread_create(&writerThread, NULL, RunBackgroundWriter, NULL) != 0)
+		return -1;
+	isWriterRunning = true;
+
+	return 0;
 }
 
+
+RC PF_Manager::Checkpoint()
+{
+	PF_PoolLock lock;
+
+	if (writeAheadLog == NULL)
+		return -1;
+
+	return TakeCheckpoint();
+}
+
+
+RC PF_Manager::GetIOStats(PF_IOStats &stats)
+{
+	PF_PoolLock lock;
+
+	stats = globalStats;
+	return 0;
+}
+
+
+RC PF_Manager::GetIOStats(const char *fileName, PF_IOStats &stats)
+{
+	PF_PoolLock lock;
+
+	// by the name the file was opened with
+	std::map<std::string, PF_IOStats>::iterator itr = fileStats.find(fileName);
+	if (itr == fileStats.end())
+		return -1;	// not opened since the last reset, or destroyed since
+
+	stats = itr->second;
+	return 0;
+}
+
+
+RC PF_Manager::ResetIOStats()
+{
+	PF_PoolLock lock;
+
+	// opened files keep pointing to their entries; the entries of the closed
+	// files are dropped, so that the map does not grow with every file ever opened
+	memset(&globalStats, 0, sizeof(globalStats));
+	std::map<std::string, PF_IOStats>::iterator itr = fileStats.begin();
+	while (itr != fileStats.end())
+	{
+		if (IsFileStatsInUse(&itr->second))
+		{
+			memset(&itr->second, 0, sizeof(itr->second));
+			++itr;
+		}
+		else
+			fileStats.erase(itr++);
+	}
+
+	return 0;
+}
+
+
+PF_FileHandle::PF_FileHandle()
+{
+	_pimpl = new PF_FileHandle_Data();
+	_pimpl->file = NULL;
+	_pimpl->asyncIO = NULL;
+	_pimpl->readAheadIO = NULL;
+	_pimpl->ring.maxFrames = 0;
+	_pimpl->ring.next = 0;
+	_pimpl->isReadAheadEnabled = true;
+	_pimpl->ResetReadAhead();
+}
+
+
+PF_FileHandle::~PF_FileHandle()
+{
+	assert(_pimpl != NULL);
+
+	if (_pimpl->file != NULL)
+		PF_Manager::Instance()->CloseFile(*this);
+
+	delete _pimpl;
+}
+
+
+RC PF_FileHandle::ReadPage(PageNum pageNum, void *data)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	if (pageNum >= file->header.num_pages)
+		return -1;	// return error
+
+	// unpin the pages read ahead as soon as they are all in
+	CompleteReadAhead(*_pimpl, false);
+
+	// keep reading ahead of sequential readers (e.g., scans)
+	if (_pimpl->isReadAheadEnabled)
+	{
+		PF_FileHandle_Data& handle = *_pimpl;
+		if (pageNum == handle.lastPageRead + 1)
+			++handle.numSequentialReads;
+		else
+			handle.ResetReadAhead();
+		handle.lastPageRead = pageNum;
+
+		if (handle.numSequentialReads >= READ_AHEAD_TRIGGER
+			&& pageNum + handle.readAheadPages / 2 >= handle.readAheadEnd)
+		{
+			PageNum startPage = handle.readAheadEnd > pageNum ? handle.readAheadEnd : pageNum + 1;
+			Prefetch(startPage, handle.readAheadPages);
+
+			// ramp up the window while the access pattern stays sequential
+			handle.readAheadEnd = startPage + handle.readAheadPages;
+			handle.readAheadPages = std::min(2 * handle.readAheadPages, MAX_READ_AHEAD_PAGES);
+		}
+	}
+
+	unsigned long long startTime = GetMicroseconds();
+	RC result = ReadPageThroughPool(file, pageNum, data, _pimpl->GetRing(), true);
+	RecordLatency(file, &PF_IOStats::readPage, startTime);
+
+	return result;
+}
+
+
+RC PF_FileHandle::WritePage(PageNum pageNum, const void *data)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	// check if the page already exists
+	if (pageNum >= file->header.num_pages)
+	{
+		return -1;	// return error
+	}
+
+	unsigned long long startTime = GetMicroseconds();
+	RC result = WritePageThroughPool(file, pageNum, data, _pimpl->GetRing(), true);
+	RecordLatency(file, &PF_IOStats::writePage, startTime);
+
+	return result;
+}
+
+
+RC PF_FileHandle::AppendPage(const void *data)
+{
+	PageNum pageNum;
+	return AppendPage(data, pageNum);
+}
+
+
+RC PF_FileHandle::AppendPage(const void *data, PageNum &pageNum)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	unsigned long long startTime = GetMicroseconds();
+	RC result = AppendPageToFile(file, data, pageNum, _pimpl->GetRing());
+	RecordLatency(file, &PF_IOStats::appendPage, startTime);
+
+	return result;
+}
+
+
+RC PF_FileHandle::EnableLogging()
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	// without an open log the file stays unlogged
+	if (writeAheadLog == NULL || file->isLogged)
+		return 0;
+
+	// the log only has the changes made from now on; the earlier ones must be durable
+	if (FlushFileData(file) != 0 || SyncPageFile(file) != 0)
+		return -1;
+
+	file->logFileId = ++lastLogFileId;
+	file->isLogged = true;
+	file->loggedHeader = file->header;
+	writeAheadLog->Append(LOG_FILE, 0, file->logFileId, 0, 0, file->name.c_str(), file->name.size());
+
+	return 0;
+}
+
+
+RC PF_FileHandle::DeallocatePage(PageNum pageNum)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	// version 1 headers have no room for the free page list
+	PF_Header& header = file->header;
+	if (header.version == VERSION_1)
+		return -1;	// return error
+
+	if (pageNum >= header.num_pages)
+		return -1;	// return error
+
+	// check that the page is not already free
+	if (!LoadFreePageSet(file) || file->freePages.count(pageNum) > 0)
+		return -1;	// return error
+
+	// link the page in front of the free page list
+	char* pageData = GetBouncePage();
+	memset(pageData, 0, file->pageSize);
+	PF_FreePage freePage;
+	memset(&freePage, 0, sizeof(freePage));
+	strcpy(freePage.tag, FREE_PAGE_TAG);
+	freePage.next_free_page = header.free_list_head;
+	memcpy(pageData, &freePage, sizeof(freePage));
+	if (WritePageThroughPool(file, pageNum, pageData, _pimpl->GetRing(), false) != 0)
+		return -1;
+
+	header.free_list_head = pageNum;
+	header.num_free_pages += 1;
+	file->freePages.insert(pageNum);
+
+	return UpdateHeader(file);
+}
+
+
+bool PF_FileHandle::IsPageFree(PageNum pageNum)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return false;
+
+	if (file->header.num_free_pages == 0)
+		return false;
+
+	return LoadFreePageSet(file) && file->freePages.count(pageNum) > 0;
+}
+
+
+RC PF_FileHandle::AppendPages(unsigned count, const void *data)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	if (count == 0)
+		return 0;
+
+	PF_Header& header = file->header;
+	PageNum firstPageNum = header.num_pages;
+	if (AllocateExtent(file, firstPageNum + count) != 0)
+		return -1;
+
+	// pages written directly must not be overwritten by older copies
+	bufferPool->WaitForWrites(file);
+
+	// drop stale cached copies of the pages about to be written
+	for (unsigned i = 0; i < count; ++i)
+	{
+		unsigned frameIndex = bufferPool->FindFrame(file->key, firstPageNum + i);
+		if (frameIndex != INVALID_FRAME)
+			bufferPool->ReleaseFrame(frameIndex);
+	}
+
+	// logged files make the new pages durable in the log before writing them
+	if (file->isLogged)
+	{
+		const char* pageData = reinterpret_cast<const char*>(data);
+		for (unsigned i = 0; i < count; ++i)
+			writeAheadLog->Append(LOG_PAGE_IMAGE, BeginOperation(), file->logFileId, firstPageNum + i, 0, pageData + i * file->pageSize, file->pageSize);
+		if (!writeAheadLog->FlushAll())
+			return -1;	// return error
+	}
+
+	// write all pages in one go, bypassing the buffer pool
+	if (file->isCompressed || (file->isDirectIO && !IsPageAligned(data)))
+	{
+		// compressed pages and unaligned data cannot be transferred directly; go page by page
+		const char* pageData = reinterpret_cast<const char*>(data);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			if (WritePageToFile(file, firstPageNum + i, pageData + i * file->pageSize) != 0)
+				return -1;	// return error
+		}
+	}
+	else
+	{
+		off_t page_offset = GetPageOffset(file, firstPageNum);
+		CountPageIO(file, true, count);
+		if (!WriteToFile(file->fd, data, static_cast<size_t>(count) * file->pageSize, page_offset))
+			return -1;	// return error
+	}
+
+	// update header once for the whole batch
+	header.num_pages += count;
+	return UpdateHeader(file);
+}
+
+
+RC PF_FileHandle::ReadPages(PageNum startPage, unsigned count, void *data)
+{
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	if (count == 0)
+		return 0;
+
+	std::vector<PageNum> pageNums(count);
+	std::vector<void*> pageData(count);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		pageNums[i] = startPage + i;
+		pageData[i] = reinterpret_cast<char*>(data) + static_cast<size_t>(i) * file->pageSize;
+	}
+
+	return ReadPages(&pageNums[0], count, &pageData[0]);
+}
+
+
+RC PF_FileHandle::ReadPages(const PageNum *pageNums, unsigned count, void *const *data)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		if (pageNums[i] >= file->header.num_pages)
+			return -1;	// return error
+	}
+
+	std::vector<std::pair<PageNum, unsigned> > pagesToRead;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		// cached pages (possibly newer than the file) are copied right away
+		unsigned frameIndex = bufferPool->FindFrame(file->key, pageNums[i]);
+		if (frameIndex != INVALID_FRAME)
+		{
+			PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+			frame.isReferenced = true;
+			memcpy(data[i], frame.data, file->pageSize);
+			continue;
+		}
+
+		// compressed pages and unaligned buffers of direct I/O files are read one by one
+		if (file->isCompressed || (file->isDirectIO && !IsPageAligned(data[i])))
+		{
+			if (ReadPageFromFile(file, pageNums[i], data[i]) != 0)
+				return -1;
+			continue;
+		}
+
+		pagesToRead.push_back(std::make_pair(pageNums[i], i));
+	}
+
+	// the other pages are read in runs of consecutive pages
+	std::sort(pagesToRead.begin(), pagesToRead.end());
+	CountPageIO(file, false, pagesToRead.size());
+	return TransferPageRuns(file, false, pagesToRead, data);
+}
+
+
+RC PF_FileHandle::WritePages(PageNum startPage, unsigned count, const void *data)
+{
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	if (count == 0)
+		return 0;
+
+	std::vector<PageNum> pageNums(count);
+	std::vector<const void*> pageData(count);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		pageNums[i] = startPage + i;
+		pageData[i] = reinterpret_cast<const char*>(data) + static_cast<size_t>(i) * file->pageSize;
+	}
+
+	return WritePages(&pageNums[0], count, &pageData[0]);
+}
+
+
+RC PF_FileHandle::WritePages(const PageNum *pageNums, unsigned count, const void *const *data)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		if (pageNums[i] >= file->header.num_pages)
+			return -1;	// return error
+	}
+
+	// pages written directly must not be overwritten by older copies
+	bufferPool->WaitForWrites(file);
+
+	// logged files log the pages whole, so the old pages are not read. Whole
+	// pages cannot be undone: the calling thread's operation commits along
+	// with them, before any of them is written. A write that fails after that
+	// leaves the pages to recovery
+	if (file->isLogged && count > 0)
+	{
+		for (unsigned i = 0; i < count; ++i)
+			writeAheadLog->Append(LOG_PAGE_IMAGE, BeginOperation(), file->logFileId, pageNums[i], 0, data[i], file->pageSize);
+		if (!writeAheadLog->Flush(AppendCommitRecord(writeAheadLog)))
+			return -1;	// return error
+	}
+
+	std::vector<std::pair<PageNum, unsigned> > pagesToWrite;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		// cached copies take the new data; the writes below write it out. A
+		// pinned page of a logged file logs its later changes against it
+		unsigned frameIndex = bufferPool->FindFrame(file->key, pageNums[i]);
+		if (frameIndex != INVALID_FRAME)
+		{
+			PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+			memcpy(frame.data, data[i], file->pageSize);
+			if (frame.pinnedData != NULL)
+				memcpy(frame.pinnedData, data[i], file->pageSize);
+			bufferPool->MarkFrameClean(frameIndex);
+		}
+
+		// compressed pages and unaligned buffers of direct I/O files are written one by one
+		if (file->isCompressed || (file->isDirectIO && !IsPageAligned(data[i])))
+		{
+			if (WritePageToFile(file, pageNums[i], data[i]) != 0)
+				return -1;
+			continue;
+		}
+
+		pagesToWrite.push_back(std::make_pair(pageNums[i], i));
+	}
+
+	// the other pages are written in runs of consecutive pages; a page listed
+	// more than once gets the data listed last
+	std::sort(pagesToWrite.begin(), pagesToWrite.end());
+	CountPageIO(file, true, pagesToWrite.size());
+	return TransferPageRuns(file, true, pagesToWrite, const_cast<void* const*>(data));
+}
+
+
+RC PF_FileHandle::PinPage(PageNum pageNum, void *&data)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	if (pageNum >= file->header.num_pages)
+		return -1;	// return error
+
+	unsigned frameIndex = bufferPool->FindFrame(file->key, pageNum);
+	if (frameIndex == INVALID_FRAME)
+	{
+		frameIndex = bufferPool->AllocateFrame(file->key, pageNum, file->pageSize, NULL, true);
+		if (frameIndex == INVALID_FRAME)
+			return -1;	// all frames are pinned
+
+		if (bufferPool->GetFrame(frameIndex).isReadInProgress && LoadFrame(file, frameIndex, true) != 0)
+			return -1;
+	}
+
+	// logged files log the changes made through the pointer against a copy
+	PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+	if (file->isLogged && frame.pinnedData == NULL)
+	{
+		frame.pinnedData = reinterpret_cast<char*>(malloc(file->pageSize));
+		if (frame.pinnedData == NULL)
+			return -1;
+		memcpy(frame.pinnedData, frame.data, file->pageSize);
+	}
+
+	++frame.pinCount;
+	frame.isReferenced = true;
+	data = frame.data;
+
+	return 0;
+}
+
+
+RC PF_FileHandle::UnpinPage(PageNum pageNum, bool isDirty)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	unsigned frameIndex = bufferPool->FindFrame(file->key, pageNum);
+	if (frameIndex == INVALID_FRAME)
+		return -1;	// page is not pinned
+
+	PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+	if (frame.pinCount == 0)
+		return -1;	// page is not pinned
+
+	--frame.pinCount;
+	RC result = 0;
+	if (isDirty)
+	{
+		unsigned long long recLSN = GetLogEndLSN(file);
+		if (file->isLogged && frame.pinnedData != NULL)
+		{
+			LogPageChange(file, pageNum, frame.pinnedData, frame.data);
+			memcpy(frame.pinnedData, frame.data, file->pageSize);
+		}
+		else if (file->isLogged)
+		{
+			// pinned before logging was enabled; the old contents are gone
+			writeAheadLog->Append(LOG_PAGE_IMAGE, BeginOperation(), file->logFileId, pageNum, 0, frame.data, file->pageSize);
+		}
+
+		bufferPool->MarkFrameDirty(frameIndex, file, recLSN);
+		result = FlushFileDataOverThreshold(file);
+	}
+
+	if (frame.pinCount == 0)
+	{
+		free(frame.pinnedData);
+		frame.pinnedData = NULL;
+	}
+
+	return result;
+}
+
+
+RC PF_FileHandle::ReadPagesAsync(const PageNum *pageNums, unsigned count, void *const *data)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		if (pageNums[i] >= file->header.num_pages)
+			return -1;	// return error
+	}
+
+	if (_pimpl->asyncIO == NULL)
+		_pimpl->asyncIO = new PF_AsyncIO(ASYNC_QUEUE_DEPTH);
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		// cached pages (possibly newer than the file) are copied right away
+		unsigned frameIndex = bufferPool->FindFrame(file->key, pageNums[i]);
+		if (frameIndex != INVALID_FRAME)
+		{
+			PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+			frame.isReferenced = true;
+			memcpy(data[i], frame.data, file->pageSize);
+			continue;
+		}
+
+		// compressed pages and unaligned buffers of direct I/O files are read synchronously
+		if (file->isCompressed || (file->isDirectIO && !IsPageAligned(data[i])))
+		{
+			if (ReadPageFromFile(file, pageNums[i], data[i]) != 0)
+				return -1;
+			continue;
+		}
+
+		CountPageIO(file, false, 1);
+		if (!_pimpl->asyncIO->Submit(false, file->fd, data[i], file->pageSize, GetPageOffset(file, pageNums[i])))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+RC PF_FileHandle::WritePagesAsync(const PageNum *pageNums, unsigned count, const void *const *data)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		if (pageNums[i] >= file->header.num_pages)
+			return -1;	// return error
+	}
+
+	if (_pimpl->asyncIO == NULL)
+		_pimpl->asyncIO = new PF_AsyncIO(ASYNC_QUEUE_DEPTH);
+
+	// pages written directly must not be overwritten by older copies
+	bufferPool->WaitForWrites(file);
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		// changes to logged files are logged and written back later
+		if (file->isLogged)
+		{
+			if (WritePageThroughPool(file, pageNums[i], data[i], _pimpl->GetRing(), true) != 0)
+				return -1;
+			continue;
+		}
+
+		// cached copies take the new data; the request below writes it out
+		unsigned frameIndex = bufferPool->FindFrame(file->key, pageNums[i]);
+		if (frameIndex != INVALID_FRAME)
+		{
+			memcpy(bufferPool->GetFrame(frameIndex).data, data[i], file->pageSize);
+			bufferPool->MarkFrameClean(frameIndex);
+		}
+
+		// compressed pages and unaligned buffers of direct I/O files are written synchronously
+		if (file->isCompressed || (file->isDirectIO && !IsPageAligned(data[i])))
+		{
+			if (WritePageToFile(file, pageNums[i], data[i]) != 0)
+				return -1;
+			continue;
+		}
+
+		CountPageIO(file, true, 1);
+		if (!_pimpl->asyncIO->Submit(true, file->fd, const_cast<void*>(data[i]), file->pageSize, GetPageOffset(file, pageNums[i])))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+RC PF_FileHandle::WaitForIO()
+{
+	PF_PoolLock lock;
+
+	// a failed read-ahead only drops its pages; they are read again on demand
+	CompleteReadAhead(*_pimpl, true);
+
+	if (_pimpl->asyncIO == NULL)
+		return 0;
+
+	return _pimpl->asyncIO->WaitAll() ? 0 : -1;
+}
+
+
+unsigned PF_FileHandle::GetNumPendingIO()
+{
+	PF_PoolLock lock;
+
+	if (_pimpl->asyncIO == NULL)
+		return 0;
+
+	_pimpl->asyncIO->Reap(false);
+	return _pimpl->asyncIO->GetNumPending();
+}
+
+
+RC PF_FileHandle::Prefetch(PageNum startPage, unsigned count)
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	if (startPage >= file->header.num_pages)
+		return 0;	// nothing to read
+	if (count > file->header.num_pages - startPage)
+		count = static_cast<unsigned>(file->header.num_pages - startPage);
+
+	// hint only: the kernel reads the range in the background, so the
+	// ReadPage() calls that follow find the data in memory
+	if (file->isCompressed)
+	{
+		for (PageNum pageNum = startPage; pageNum < startPage + count && pageNum < file->pageMap.size(); ++pageNum)
+		{
+			const PF_PageExtent& extent = file->pageMap[pageNum];
+			if (extent.numSectors > 0)
+				posix_fadvise(file->fd, extent.sector * SECTOR_SIZE, extent.length, POSIX_FADV_WILLNEED);
+		}
+		return 0;
+	}
+
+	if (!file->isDirectIO)
+	{
+		off_t offset = GetPageOffset(file, startPage);
+		off_t length = static_cast<off_t>(count) * file->pageSize;
+		posix_fadvise(file->fd, offset, length, POSIX_FADV_WILLNEED);
+		return 0;
+	}
+
+	// direct I/O files have no kernel read-ahead; read the missing pages into
+	// the buffer pool as one batch, using at most a quarter of the pool (half
+	// the ring of the handle, so the pages are not recycled before they are read)
+	unsigned maxPages = bufferPool->GetNumFrames() / 4;
+	if (_pimpl->GetRing() != NULL)
+		maxPages = std::min(maxPages, std::max(1U, _pimpl->ring.maxFrames / 2));
+	if (count > maxPages)
+		count = maxPages;
+
+	// one batch in flight at a time; the reader needs the previous one first anyway
+	CompleteReadAhead(*_pimpl, true);
+	if (_pimpl->readAheadIO == NULL)
+		_pimpl->readAheadIO = new PF_AsyncIO(ASYNC_QUEUE_DEPTH);
+
+	for (PageNum pageNum = startPage; pageNum < startPage + count; ++pageNum)
+	{
+		if (bufferPool->FindFrame(file->key, pageNum) != INVALID_FRAME)
+			continue;
+
+		unsigned frameIndex = bufferPool->AllocateFrame(file->key, pageNum, file->pageSize, _pimpl->GetRing(), false);
+		if (frameIndex == INVALID_FRAME)
+			break;
+
+		// pinned until the read is reaped, so the frame is not handed out again;
+		// readers of the page wait for the batch (see FindFrame())
+		PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+		++frame.pinCount;
+		frame.readAhead = _pimpl;
+		_pimpl->readAheadFrames.push_back(frameIndex);
+		CountPageIO(file, false, 1);
+		if (!_pimpl->readAheadIO->Submit(false, file->fd, frame.data, file->pageSize, GetPageOffset(file, pageNum)))
+		{
+			// the failure drops the whole batch once the requests already queued are done
+			CompleteReadAhead(*_pimpl, true);
+			return -1;
+		}
+	}
+
+	// pass the batch on to the kernel and go on; the next ReadPage() or WaitForIO() reaps it
+	_pimpl->readAheadIO->Reap(false);
+
+	return 0;
+}
+
+
+void PF_FileHandle::SetReadAhead(bool isEnabled)
+{
+	PF_PoolLock lock;
+
+	_pimpl->isReadAheadEnabled = isEnabled;
+	_pimpl->ResetReadAhead();
+}
+
+
+void PF_FileHandle::SetAccessRing(unsigned numPages)
+{
+	PF_PoolLock lock;
+
+	// the frames of the old ring go back to the pool, once none is being read into
+	CompleteReadAhead(*_pimpl, true);
+	bufferPool->ReleaseRing(_pimpl->ring);
+	_pimpl->ring.maxFrames = numPages;
+}
+
+
+RC PF_FileHandle::Sync()
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	PF_File* file = _pimpl->file;
+	if (file == NULL)
+		return -1;
+
+	// the log records go first (see FlushFileData()); the other threads go on
+	// meanwhile, as in Commit()
+	if (file->isLogged)
+	{
+		PF_Log* log = writeAheadLog;
+		pthread_mutex_unlock(&poolMutex);
+		bool isFlushed = log->FlushAll();
+		pthread_mutex_lock(&poolMutex);
+		if (!isFlushed)
+			return -1;
+	}
+
+	if (FlushFileData(file) != 0)
+		return -1;
+
+	// make the written data durable. Compressed files write their page map
+	// after the sync, under the lock
+	++globalStats.syncs;
+	++file->stats->syncs;
+	if (file->isCompressed)
+		return SyncPageFile(file);
+
+	int fd = file->fd;
+	pthread_mutex_unlock(&poolMutex);
+	bool isSynced = fdatasync(fd) == 0;
+	pthread_mutex_lock(&poolMutex);
+
+	return isSynced ? 0 : -1;
+}
+
+
+unsigned PF_FileHandle::GetNumberOfPages()
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	assert(_pimpl->file != NULL);
+
+	return static_cast<unsigned>(_pimpl->file->header.num_pages);
+}
+
+
+unsigned PF_FileHandle::GetPageSize()
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	assert(_pimpl->file != NULL);
+
+	return _pimpl->file->pageSize;
+}
+
+
+unsigned PF_FileHandle::GetNumberOfFreePages()
+{
+	PF_PoolLock lock;
+
+	// check that a file is opened
+	assert(_pimpl->file != NULL);
+
+	return static_cast<unsigned>(_pimpl->file->header.num_free_pages);
+}
+
+
+PF_BufferPool::PF_BufferPool(unsigned numFrames)
+	: _frames(numFrames), _freeHand(0), _hotHand(0), _numCold(0), _numHot(0),
+	  _numWritesInProgress(0), _numColdEntries(0), _numColdEvictions(0)
+{
+	// use a power of two number of buckets, about twice the number of frames
+	unsigned numBuckets = 1;
+	while (numBuckets < 2 * numFrames)
+		numBuckets <<= 1;
+	_buckets.assign(numBuckets, INVALID_FRAME);
+
+	for (unsigned i = 0; i < numFrames; ++i)
+	{
+		PF_Frame& frame = _frames[i];
+		frame.pageNum = 0;
+		frame.file = NULL;
+		frame.pinCount = 0;
+		frame.isValid = false;
+		frame.isDirty = false;
+		frame.isReferenced = false;
+		frame.isHot = false;
+		frame.coldEntry = 0;
+		frame.isWriteInProgress = false;
+		frame.isReadInProgress = false;
+		frame.ring = NULL;
+		frame.readAhead = NULL;
+		frame.recLSN = NO_LSN;
+		frame.pinnedData = NULL;
+		frame.nextInBucket = INVALID_FRAME;
+		frame.data = NULL;
+		frame.dataSize = 0;
+	}
+}
+
+
+PF_BufferPool::~PF_BufferPool()
+{
+	for (unsigned i = 0; i < _frames.size(); ++i)
+	{
+		free(_frames[i].data);
+		free(_frames[i].pinnedData);
+	}
+}
+
+
+unsigned PF_BufferPool::FindFrame(const PF_FileKey& key, PageNum pageNum)
+{
+	unsigned frameIndex = _buckets[ComputeBucket(key, pageNum)];
+	while (frameIndex != INVALID_FRAME)
+	{
+		PF_Frame& frame = _frames[frameIndex];
+		if (frame.pageNum == pageNum && frame.key == key)
+		{
+			// another thread is reading the page in; look again once it is done (it may fail)
+			if (frame.isReadInProgress)
+			{
+				pthread_cond_wait(&writesDone, &poolMutex);
+				return FindFrame(key, pageNum);
+			}
+
+			// the page is usable once its read-ahead is reaped; a failed one drops the page
+			if (frame.readAhead != NULL)
+			{
+				CompleteReadAhead(*frame.readAhead, true);
+				return frame.isValid ? frameIndex : INVALID_FRAME;
+			}
+			return frameIndex;
+		}
+
+		frameIndex = frame.nextInBucket;
+	}
+
+	return INVALID_FRAME;
+}
+
+bool PF_BufferPool::HasFrame(const PF_FileKey& key, PageNum pageNum) const
+{
+	// unlike FindFrame(), neither waits for reads nor reaps read-ahead
+	for (unsigned frameIndex = _buckets[ComputeBucket(key, pageNum)]; frameIndex != INVALID_FRAME;
+		frameIndex = _frames[frameIndex].nextInBucket)
+	{
+		if (_frames[frameIndex].pageNum == pageNum && _frames[frameIndex].key == key)
+			return true;
+	}
+	return false;
+}
+
+
+unsigned PF_BufferPool::AllocateFrame(const PF_FileKey& key, PageNum pageNum, unsigned pageSize, PF_AccessRing* ring,
+	bool isUnlockAllowed)
+{
+	assert(!HasFrame(key, pageNum));
+
+	// pages read through a ring recycle its frames
+	unsigned ringSlot = INVALID_FRAME;
+	unsigned frameIndex = INVALID_FRAME;
+	if (ring != NULL)
+		frameIndex = FindRingVictim(*ring, ringSlot);
+	while (true)
+	{
+		if (frameIndex == INVALID_FRAME)
+			frameIndex = FindVictim();
+		if (frameIndex == INVALID_FRAME)
+			return INVALID_FRAME;
+
+		PF_Frame& victim = _frames[frameIndex];
+		if (!isUnlockAllowed || !victim.isValid || !victim.isDirty)
+			break;
+
+		// write the victim back with the lock released. Another thread may
+		// read our page in meanwhile, or take the frame; look again after it
+		if (!FlushFrame(frameIndex, true))
+			return INVALID_FRAME;
+		unsigned cachedFrame = FindFrame(key, pageNum);
+		if (cachedFrame != INVALID_FRAME)
+			return cachedFrame;
+		if (victim.pinCount == 0 && !victim.isWriteInProgress && !victim.isDirty)
+			break;
+		frameIndex = INVALID_FRAME;
+	}
+
+	// evict the current page of the frame
+	PF_Frame& frame = _frames[frameIndex];
+	if (frame.isValid)
+	{
+		if (!FlushFrame(frameIndex, false))
+			return INVALID_FRAME;
+		RemoveFromBucket(frameIndex);
+
+		// remember the cold pages evicted, unless they were only read through a ring
+		if (!frame.isHot && frame.ring == NULL)
+		{
+			PageId pageId(frame.key, frame.pageNum);
+			_ghosts[pageId] = ++_numColdEvictions;
+			_ghostOrder.push_back(std::make_pair(pageId, _numColdEvictions));
+
+			unsigned maxGhosts = std::max(1U, GetNumFrames() * GHOST_PERCENT / 100);
+			while (_ghostOrder.size() > maxGhosts)
+			{
+				std::map<PageId, unsigned long long>::iterator ghostItr = _ghosts.find(_ghostOrder.front().first);
+				if (ghostItr != _ghosts.end() && ghostItr->second == _ghostOrder.front().second)
+					_ghosts.erase(ghostItr);
+				_ghostOrder.pop_front();
+			}
+		}
+
+		RemoveFromSets(frameIndex);
+		frame.isValid = false;
+	}
+
+	// size the buffer for the page; page-aligned, as direct I/O requires
+	if (frame.dataSize != pageSize)
+	{
+		void* frameData = NULL;
+		if (posix_memalign(&frameData, PF_PAGE_SIZE, pageSize) != 0)
+			return INVALID_FRAME;
+		free(frame.data);
+		frame.data = reinterpret_cast<char*>(frameData);
+		frame.dataSize = pageSize;
+	}
+
+	// assign the frame to the new page; the caller fills in the data (or releases the frame)
+	unsigned bucket = ComputeBucket(key, pageNum);
+	frame.key = key;
+	frame.pageNum = pageNum;
+	frame.file = NULL;
+	frame.isValid = true;
+	frame.isDirty = false;
+	frame.isReferenced = true;
+	frame.nextInBucket = _buckets[bucket];
+	_buckets[bucket] = frameIndex;
+
+	// a page evicted from the cold set not long ago is in use; keep it hot
+	std::map<PageId, unsigned long long>::iterator ghostItr = _ghosts.find(PageId(key, pageNum));
+	frame.isHot = ring == NULL && ghostItr != _ghosts.end();
+	if (ghostItr != _ghosts.end())
+		_ghosts.erase(ghostItr);
+	if (frame.isHot)
+		++_numHot;
+	else
+	{
+		++_numCold;
+		frame.coldEntry = ++_numColdEntries;
+		_coldQueue.push_back(std::make_pair(frameIndex, frame.coldEntry));
+
+		// drop the skipped entries once they outnumber the frames
+		if (_coldQueue.size() > 2 * GetNumFrames())
+		{
+			std::deque<std::pair<unsigned, unsigned long long> > coldQueue;
+			for (size_t i = 0; i < _coldQueue.size(); ++i)
+			{
+				if (_frames[_coldQueue[i].first].coldEntry == _coldQueue[i].second)
+					coldQueue.push_back(_coldQueue[i]);
+			}
+			_coldQueue.swap(coldQueue);
+		}
+	}
+
+	frame.ring = ring;
+	if (ring != NULL)
+		ring->frames[ringSlot] = frameIndex;
+
+	// the caller reads the page in with the lock released (see LoadFrame());
+	// other threads wait for it
+	if (isUnlockAllowed)
+	{
+		frame.isReadInProgress = true;
+		++frame.pinCount;
+	}
+
+	return frameIndex;
+}
+
+
+void PF_BufferPool::ReleaseFrame(unsigned frameIndex)
+{
+	PF_Frame& frame = _frames[frameIndex];
+	if (!frame.isValid)
+		return;
+
+	assert(!frame.isWriteInProgress && !frame.isReadInProgress);
+
+	MarkFrameClean(frameIndex);
+	RemoveFromBucket(frameIndex);
+	RemoveFromSets(frameIndex);
+	frame.pinCount = 0;
+	free(frame.pinnedData);
+	frame.pinnedData = NULL;
+	frame.isValid = false;
+	frame.isReferenced = false;
+}
+
+
+void PF_BufferPool::ReleaseRing(PF_AccessRing& ring)
+{
+	// the pages stay cached as ordinary cold pages
+	for (unsigned i = 0; i < ring.frames.size(); ++i)
+	{
+		unsigned frameIndex = ring.frames[i];
+		if (frameIndex < _frames.size() && _frames[frameIndex].ring == &ring)
+			_frames[frameIndex].ring = NULL;
+	}
+
+	ring.frames.clear();
+	ring.next = 0;
+}
+
+
+void PF_BufferPool::MarkFrameDirty(unsigned frameIndex, PF_File* file, unsigned long long recLSN)
+{
+	PF_Frame& frame = _frames[frameIndex];
+	if (frame.isDirty)
+		return;
+
+	if (!file->HasPendingWrites())
+		file->firstDirtyTime = time(NULL);
+	++file->numDirtyPages;
+
+	// a copy being written still needs the older records
+	if (!frame.isWriteInProgress || recLSN < frame.recLSN)
+		frame.recLSN = recLSN;
+	frame.isDirty = true;
+	frame.file = file;
+}
+
+
+void PF_BufferPool::MarkFrameClean(unsigned frameIndex)
+{
+	PF_Frame& frame = _frames[frameIndex];
+	if (!frame.isDirty)
+		return;
+
+	assert(frame.file->numDirtyPages > 0);
+	--frame.file->numDirtyPages;
+
+	frame.isDirty = false;
+	frame.file = NULL;
+}
+
+
+bool PF_BufferPool::FlushFile(PF_File* file)
+{
+	// the pages being written in the background are written (again) after their copies
+	WaitForWrites(file);
+	if (file->numDirtyPages == 0)
+		return true;
+
+	// write the dirty pages in page order
+	std::vector<std::pair<PageNum, unsigned> > dirtyFrames;
+	for (unsigned i = 0; i < _frames.size(); ++i)
+	{
+		if (_frames[i].isDirty && _frames[i].file == file)
+			dirtyFrames.push_back(std::make_pair(_frames[i].pageNum, i));
+	}
+	std::sort(dirtyFrames.begin(), dirtyFrames.end());
+
+	// keep all the writes in flight together
+	if (writeBackIO == NULL)
+		writeBackIO = new PF_AsyncIO(ASYNC_QUEUE_DEPTH);
+
+	bool result = true;
+	for (unsigned i = 0; i < dirtyFrames.size(); ++i)
+	{
+		PF_Frame& frame = _frames[dirtyFrames[i].second];
+		if (file->isCompressed)
+		{
+			result = WritePageToFile(file, frame.pageNum, frame.data) == 0 && result;
+			continue;
+		}
+		CountPageIO(file, true, 1);
+		result = writeBackIO->Submit(true, file->fd, frame.data, file->pageSize, GetPageOffset(file, frame.pageNum)) && result;
+	}
+	result = writeBackIO->WaitAll() && result;
+
+	// pages stay dirty (and are written again later) if any write failed
+	if (result)
+	{
+		for (unsigned i = 0; i < dirtyFrames.size(); ++i)
+			MarkFrameClean(dirtyFrames[i].second);
+	}
+
+	return result;
+}
+
+
+bool PF_BufferPool::FlushAll()
+{
+	WaitForWrites(NULL);
+
+	bool result = true;
+	for (unsigned i = 0; i < _frames.size(); ++i)
+		result = FlushFrame(i, false) && result;
+
+	return result;
+}
+
+
+bool PF_BufferPool::IsAnyFramePinned() const
+{
+	for (unsigned i = 0; i < _frames.size(); ++i)
+	{
+		if (_frames[i].pinCount > 0)
+			return true;
+	}
+
+	return false;
+}
+
+
+void PF_BufferPool::InvalidateFile(const PF_FileKey& key)
+{
+	WaitForWrites(NULL);
+
+	for (unsigned i = 0; i < _frames.size(); ++i)
+	{
+		while (_frames[i].isReadInProgress && _frames[i].key == key)
+			pthread_cond_wait(&writesDone, &poolMutex);
+		if (_frames[i].readAhead != NULL && _frames[i].key == key)
+			CompleteReadAhead(*_frames[i].readAhead, true);
+		if (_frames[i].isValid && _frames[i].key == key)
+			ReleaseFrame(i);
+	}
+}
+
+
+unsigned PF_BufferPool::ComputeBucket(const PF_FileKey& key, PageNum pageNum) const
+{
+	unsigned long long hash = static_cast<unsigned long long>(key.inode) * 0x9E3779B97F4A7C15ULL;
+	hash ^= static_cast<unsigned long long>(key.device) + (hash << 6) + (hash >> 2);
+	hash += pageNum;
+	hash ^= hash >> 29;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 32;
+
+	return static_cast<unsigned>(hash) & (_buckets.size() - 1);
+}
+
+
+unsigned PF_BufferPool::FindVictim()
+{
+	// free frames and cold pages go first, as long as the cold set has more
+	// than its share of the frames; the hot set gives up pages to make room
+	unsigned numFrames = _frames.size();
+	unsigned minCold = std::max(1U, numFrames * MIN_COLD_PERCENT / 100);
+	unsigned frameIndex = INVALID_FRAME;
+	if (_numCold + _numHot < numFrames || _numCold > minCold || _numHot == 0)
+		frameIndex = FindColdVictim();
+	if (frameIndex == INVALID_FRAME)
+		frameIndex = FindHotVictim();
+
+	// the hot pages are all pinned
+	if (frameIndex == INVALID_FRAME)
+		frameIndex = FindColdVictim();
+
+	return frameIndex;
+}
+
+
+unsigned PF_BufferPool::FindColdVictim()
+{
+	// no page is evicted while there are free frames
+	unsigned numFrames = _frames.size();
+	if (_numCold + _numHot < numFrames)
+	{
+		for (unsigned i = 0; i < numFrames; ++i)
+		{
+			unsigned frameIndex = _freeHand;
+			_freeHand = (_freeHand + 1) % numFrames;
+
+			PF_Frame& frame = _frames[frameIndex];
+			if (!frame.isValid && frame.pinCount == 0)
+				return frameIndex;
+		}
+	}
+
+	// the cold page that entered the pool first, passing over those in use.
+	// The entry stays until the frame is reassigned: the caller may still
+	// find the page in use once it is written back
+	while (!_coldQueue.empty() && _frames[_coldQueue.front().first].coldEntry != _coldQueue.front().second)
+		_coldQueue.pop_front();
+	for (size_t i = 0; i < _coldQueue.size(); ++i)
+	{
+		unsigned frameIndex = _coldQueue[i].first;
+		PF_Frame& frame = _frames[frameIndex];
+		if (frame.coldEntry != _coldQueue[i].second || frame.pinCount > 0 || frame.isWriteInProgress)
+			continue;
+
+		return frameIndex;
+	}
+
+	return INVALID_FRAME;
+}
+
+
+unsigned PF_BufferPool::FindHotVictim()
+{
+	// sweep at most twice: the first pass may only clear reference bits
+	unsigned numFrames = _frames.size();
+	for (unsigned i = 0; i < 2 * numFrames; ++i)
+	{
+		unsigned frameIndex = _hotHand;
+		_hotHand = (_hotHand + 1) % numFrames;
+
+		PF_Frame& frame = _frames[frameIndex];
+		if (frame.pinCount > 0 || frame.isWriteInProgress || !frame.isHot)
+			continue;
+
+		if (frame.isReferenced)
+		{
+			frame.isReferenced = false;
+			continue;
+		}
+
+		return frameIndex;
+	}
+
+	return INVALID_FRAME;
+}
+
+
+unsigned PF_BufferPool::FindRingVictim(PF_AccessRing& ring, unsigned& ringSlot)
+{
+	// fill the ring up to its size first (at most a share of the pool)
+	unsigned maxFrames = std::max(1U, std::min(ring.maxFrames, GetNumFrames() * MAX_RING_PERCENT / 100));
+	if (ring.frames.size() < maxFrames)
+	{
+		ringSlot = ring.frames.size();
+		ring.frames.push_back(INVALID_FRAME);
+		return INVALID_FRAME;
+	}
+
+	ringSlot = ring.next;
+	ring.next = (ring.next + 1) % ring.frames.size();
+
+	// the frame of the slot may have been evicted, or pinned since
+	unsigned frameIndex = ring.frames[ringSlot];
+	if (frameIndex >= _frames.size())
+		return INVALID_FRAME;
+
+	PF_Frame& frame = _frames[frameIndex];
+	if (frame.ring != &ring || frame.pinCount > 0 || frame.isWriteInProgress)
+		return INVALID_FRAME;
+
+	return frameIndex;
+}
+
+
+bool PF_BufferPool::FlushFrame(unsigned frameIndex, bool isUnlockAllowed)
+{
+	PF_Frame& frame = _frames[frameIndex];
+	if (!frame.isValid || !frame.isDirty)
+		return true;
+
+	// a copy of the page is being written; the newer data goes after it
+	if (frame.isWriteInProgress)
+	{
+		while (frame.isWriteInProgress)
+			pthread_cond_wait(&writesDone, &poolMutex);
+		if (!frame.isValid || !frame.isDirty)
+			return true;
+	}
+
+	// compressed pages are placed through the page map, under the lock
+	PF_File* file = frame.file;
+	assert(file != NULL);
+	if (!isUnlockAllowed || file->isCompressed)
+	{
+		// write-ahead rule: the log records of the page go first
+		if (file->isLogged && !writeAheadLog->FlushAll())
+			return false;
+		if (WritePageToFile(file, frame.pageNum, frame.data) != 0)
+			return false;
+
+		MarkFrameClean(frameIndex);
+		return true;
+	}
+
+	// write a copy with the lock released, as WriteDirtyPages() does; the
+	// frame stays usable meanwhile
+	void* copy = NULL;
+	if (posix_memalign(&copy, PF_PAGE_SIZE, file->pageSize) != 0)
+		return false;
+	memcpy(copy, frame.data, file->pageSize);
+	off_t offset = GetPageOffset(file, frame.pageNum);
+	bool isLogged = file->isLogged;
+	PF_Log* log = writeAheadLog;
+
+	MarkFrameClean(frameIndex);
+	frame.isWriteInProgress = true;
+	++file->numWritesInProgress;
+	++_numWritesInProgress;
+	CountPageIO(file, true, 1);
+	pthread_mutex_unlock(&poolMutex);
+
+	// write-ahead rule: the log records of the page go first
+	bool isWritten = (!isLogged || log->FlushAll()) && WriteToFile(file->fd, copy, file->pageSize, offset);
+
+	pthread_mutex_lock(&poolMutex);
+	frame.isWriteInProgress = false;
+	--file->numWritesInProgress;
+	--_numWritesInProgress;
+	if (!isWritten)
+		MarkFrameDirty(frameIndex, file, frame.recLSN);
+	free(copy);
+	pthread_cond_broadcast(&writesDone);
+
+	return isWritten;
+}
+
+
+bool PF_BufferPool::WriteDirtyPages(unsigned maxPages)
+{
+	// the dirty pages not being changed through PinPage(), in file and page order.
+	// Compressed pages are placed as they are written; the foreground writes them
+	typedef std::pair<std::pair<PF_File*, PageNum>, unsigned> DirtyFrame;
+	std::vector<DirtyFrame> dirtyFrames;
+	for (unsigned i = 0; i < _frames.size(); ++i)
+	{
+		PF_Frame& frame = _frames[i];
+		if (frame.isValid && frame.isDirty && frame.pinCount == 0 && !frame.isWriteInProgress
+			&& !frame.file->isCompressed)
+			dirtyFrames.push_back(std::make_pair(std::make_pair(frame.file, frame.pageNum), i));
+	}
+	if (dirtyFrames.empty())
+		return true;
+
+	std::sort(dirtyFrames.begin(), dirtyFrames.end());
+	if (dirtyFrames.size() > maxPages)
+		dirtyFrames.resize(maxPages);
+
+	// write copies of the pages, so the frames stay usable meanwhile
+	std::vector<void*> copies;
+	bool isLogged = false;
+	for (unsigned i = 0; i < dirtyFrames.size(); ++i)
+	{
+		PF_File* file = dirtyFrames[i].first.first;
+		PF_Frame& frame = _frames[dirtyFrames[i].second];
+		void* copy = NULL;
+		if (posix_memalign(&copy, PF_PAGE_SIZE, file->pageSize) != 0)
+			break;
+		memcpy(copy, frame.data, file->pageSize);
+		copies.push_back(copy);
+
+		MarkFrameClean(dirtyFrames[i].second);
+		frame.isWriteInProgress = true;
+		++file->numWritesInProgress;
+		++_numWritesInProgress;
+		isLogged = isLogged || file->isLogged;
+	}
+	dirtyFrames.resize(copies.size());
+
+	PF_Log* log = writeAheadLog;
+	pthread_mutex_unlock(&poolMutex);
+
+	// write-ahead rule first; then the pages of each file in runs of consecutive pages
+	std::vector<bool> isWritten(dirtyFrames.size(), false);
+	bool isLogFlushed = !isLogged || log->FlushAll();
+	for (unsigned first = 0, last; first < dirtyFrames.size(); first = last)
+	{
+		PF_File* file = dirtyFrames[first].first.first;
+		std::vector<std::pair<PageNum, unsigned> > pages;
+		for (last = first; last < dirtyFrames.size() && dirtyFrames[last].first.first == file; ++last)
+			pages.push_back(std::make_pair(dirtyFrames[last].first.second, last));
+
+		if ((!file->isLogged || isLogFlushed) && TransferPageRuns(file, true, pages, &copies[0]) == 0)
+			std::fill(isWritten.begin() + first, isWritten.begin() + last, true);
+	}
+
+	pthread_mutex_lock(&poolMutex);
+
+	// pages stay dirty (and are written again later) if their write failed
+	bool result = true;
+	for (unsigned i = 0; i < dirtyFrames.size(); ++i)
+	{
+		PF_File* file = dirtyFrames[i].first.first;
+		PF_Frame& frame = _frames[dirtyFrames[i].second];
+		frame.isWriteInProgress = false;
+		--file->numWritesInProgress;
+		--_numWritesInProgress;
+		if (!isWritten[i])
+		{
+			MarkFrameDirty(dirtyFrames[i].second, file, frame.recLSN);
+			result = false;
+		}
+		else
+			CountPageIO(file, true, 1);
+		free(copies[i]);
+	}
+	pthread_cond_broadcast(&writesDone);
+
+	return result;
+}
+
+
+void PF_BufferPool::WaitForWrites(const PF_File* file)
+{
+	// all of them without a file
+	while (file != NULL ? file->numWritesInProgress > 0 : _numWritesInProgress > 0)
+		pthread_cond_wait(&writesDone, &poolMutex);
+}
+
+
+unsigned long long PF_BufferPool::GetMinRecLSN() const
+{
+	unsigned long long lsn = NO_LSN;
+	for (unsigned i = 0; i < _frames.size(); ++i)
+	{
+		const PF_Frame& frame = _frames[i];
+		if ((frame.isDirty || frame.isWriteInProgress) && frame.recLSN < lsn)
+			lsn = frame.recLSN;
+	}
+
+	return lsn;
+}
+
+
+void PF_BufferPool::RemoveFromBucket(unsigned frameIndex)
+{
+	PF_Frame& frame = _frames[frameIndex];
+	unsigned* link = &_buckets[ComputeBucket(frame.key, frame.pageNum)];
+	while (*link != INVALID_FRAME)
+	{
+		if (*link == frameIndex)
+		{
+			*link = frame.nextInBucket;
+			frame.nextInBucket = INVALID_FRAME;
+			return;
+		}
+
+		link = &_frames[*link].nextInBucket;
+	}
+}
+
+
+void PF_BufferPool::RemoveFromSets(unsigned frameIndex)
+{
+	PF_Frame& frame = _frames[frameIndex];
+	if (frame.isHot)
+		--_numHot;
+	else
+		--_numCold;
+
+	frame.isHot = false;
+	frame.coldEntry = 0;
+	frame.ring = NULL;
+}
+
+
+PF_PoolLock::PF_PoolLock()
+{
+	if (poolLockDepth++ == 0)
+		pthread_mutex_lock(&poolMutex);
+}
+
+
+PF_PoolLock::~PF_PoolLock()
+{
+	if (--poolLockDepth == 0)
+		pthread_mutex_unlock(&poolMutex);
+}
+
+
+PF_AsyncIO::PF_AsyncIO(unsigned queueDepth)
+	: _ringFd(-1), _numEntries(0), _numQueued(0), _numInFlight(0), _hasFailed(false)
+{
+#ifdef PF_HAS_IO_URING
+	_sqRing = _cqRing = MAP_FAILED;
+	_sqes = NULL;
+	_lastRequestId = 0;
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	_ringFd = syscall(__NR_io_uring_setup, queueDepth, &params);
+	if (_ringFd < 0)
+		return;		// not supported (or not permitted); fall back to synchronous I/O
+
+	// map the submission queue, the completion queue and the submission entries
+	_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	_sqRing = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+	_cqRing = mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+	void* sqes = mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+	if (_sqRing == MAP_FAILED || _cqRing == MAP_FAILED || sqes == MAP_FAILED)
+	{
+		if (sqes != MAP_FAILED)
+			munmap(sqes, _sqesSize);
+		if (_sqRing != MAP_FAILED)
+			munmap(_sqRing, _sqRingSize);
+		if (_cqRing != MAP_FAILED)
+			munmap(_cqRing, _cqRingSize);
+		_sqRing = _cqRing = MAP_FAILED;
+		close(_ringFd);
+		_ringFd = -1;
+		return;
+	}
+	_sqes = reinterpret_cast<io_uring_sqe*>(sqes);
+
+	char* sq = reinterpret_cast<char*>(_sqRing);
+	_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	_sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+	char* cq = reinterpret_cast<char*>(_cqRing);
+	_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	_numEntries = params.sq_entries;
+#endif
+}
+
+
+PF_AsyncIO::~PF_AsyncIO()
+{
+	WaitAll();
+
+#ifdef PF_HAS_IO_URING
+	if (_ringFd >= 0)
+	{
+		munmap(_sqes, _sqesSize);
+		munmap(_sqRing, _sqRingSize);
+		munmap(_cqRing, _cqRingSize);
+		close(_ringFd);
+	}
+#endif
+}
+
+
+bool PF_AsyncIO::Submit(bool isWrite, int fd, void* data, size_t size, off_t offset)
+{
+	// synchronous fallback
+	if (_ringFd < 0)
+	{
+		bool isDone = isWrite ? WriteToFile(fd, data, size, offset) : ReadFromFile(fd, data, size, offset);
+		if (!isDone)
+			_hasFailed = true;
+		return isDone;
+	}
+
+#ifdef PF_HAS_IO_URING
+	// the completion queue must have room for every request in flight
+	if (_numQueued + _numInFlight == _numEntries)
+	{
+		if (!Enter(1))
+		{
+			_hasFailed = true;
+			return false;
+		}
+		Reap(false);
+	}
+
+	unsigned tail = *_sqTail;
+	unsigned index = tail & *_sqMask;
+	io_uring_sqe& sqe = _sqes[index];
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe.fd = fd;
+	sqe.addr = reinterpret_cast<unsigned long>(data);
+	sqe.len = size;
+	sqe.off = offset;
+	// submission slots are reused as soon as the kernel takes the request,
+	// so completions are matched by a request id of their own
+	sqe.user_data = ++_lastRequestId;
+	_requestSizes[_lastRequestId] = size;
+	_sqArray[index] = index;
+
+	__atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+	++_numQueued;
+
+	// pass full batches on to the kernel; the request stays queued if that fails
+	if (_numQueued >= _numEntries / 2 && !Enter(0))
+	{
+		_hasFailed = true;
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+
+unsigned PF_AsyncIO::Reap(bool isWaiting)
+{
+	unsigned numReaped = 0;
+
+#ifdef PF_HAS_IO_URING
+	if (_ringFd < 0)
+		return 0;
+
+	if (_numQueued > 0 || (isWaiting && _numInFlight > 0))
+	{
+		if (!Enter(isWaiting ? _numQueued + _numInFlight : 0))
+			return 0;
+	}
+
+	unsigned head = *_cqHead;
+	while (head != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE))
+	{
+		const io_uring_cqe& cqe = _cqes[head & *_cqMask];
+		std::map<unsigned long long, size_t>::iterator sizeItr = _requestSizes.find(cqe.user_data);
+		assert(sizeItr != _requestSizes.end());
+		if (cqe.res < 0 || static_cast<size_t>(cqe.res) != sizeItr->second)
+			_hasFailed = true;
+		_requestSizes.erase(sizeItr);
+
+		++head;
+		++numReaped;
+	}
+	__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+
+	assert(numReaped <= _numInFlight);
+	_numInFlight -= numReaped;
+#endif
+
+	return numReaped;
+}
+
+
+bool PF_AsyncIO::WaitAll()
+{
+	while (GetNumPending() > 0)
+	{
+		unsigned numPending = GetNumPending();
+		Reap(true);
+		if (GetNumPending() == numPending)
+		{
+			// the ring is unusable; the requests are lost
+			_numQueued = _numInFlight = 0;
+			_hasFailed = true;
+#ifdef PF_HAS_IO_URING
+			_requestSizes.clear();
+#endif
+		}
+	}
+
+	bool result = !_hasFailed;
+	_hasFailed = false;
+	return result;
+}
+
+
+bool PF_AsyncIO::Enter(unsigned minComplete)
+{
+#ifdef PF_HAS_IO_URING
+	unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	while (true)
+	{
+		int numSubmitted = syscall(__NR_io_uring_enter, _ringFd, _numQueued, minComplete, flags, NULL, 0);
+		if (numSubmitted < 0 && errno == EINTR)
+			continue;
+		if (numSubmitted < 0)
+			return false;
+
+		_numQueued -= numSubmitted;
+		_numInFlight += numSubmitted;
+		return true;
+	}
+#else
+	return false;
+#endif
+}
+
+PF_Log::PF_Log()
+	: _fd(-1), _isFlushing(false), _baseLSN(0), _bufferLSN(0), _flushedLSN(0)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_flushDone, NULL);
+}
+
+
+PF_Log::~PF_Log()
+{
+	if (_fd >= 0)
+		Close();
+
+	pthread_cond_destroy(&_flushDone);
+	pthread_mutex_destroy(&_mutex);
+}
+
+
+bool PF_Log::Open(const char* fileName)
+{
+	_fileName = fileName;
+	_fd = open(fileName, O_RDWR | O_CREAT, 0644);
+	if (_fd < 0)
+		return false;
+
+	struct stat stFileInfo;
+	if (fstat(_fd, &stFileInfo) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	// start a new log, or check the header of an existing one
+	PF_LogHeader header;
+	memset(&header, 0, sizeof(header));
+	if (stFileInfo.st_size < static_cast<off_t>(sizeof(header)))
+	{
+		if (!WriteHeader(_fd, 0) || fdatasync(_fd) != 0)
+		{
+			Close();
+			return false;
+		}
+		stFileInfo.st_size = sizeof(header);
+	}
+	else if (!ReadFromFile(_fd, &header, sizeof(header), 0) || strcmp(header.tag, LOG_TAG) != 0)
+	{
+		Close();
+		return false;
+	}
+	else if (header.version != LOG_VERSION)
+	{
+		// an empty log of an older version is started over; records are not converted
+		if (stFileInfo.st_size > static_cast<off_t>(sizeof(header))
+			|| !WriteHeader(_fd, header.base_lsn) || fdatasync(_fd) != 0)
+		{
+			Close();
+			return false;
+		}
+	}
+
+	// the log ends at the first incomplete or corrupted record (the write
+	// that was in progress when the system went down); cut that off
+	std::vector<char> data(stFileInfo.st_size - sizeof(header));
+	if (!data.empty() && !ReadFromFile(_fd, &data[0], data.size(), sizeof(header)))
+	{
+		Close();
+		return false;
+	}
+	size_t validSize = GetValidLogSize(data, header.base_lsn);
+	if (validSize < data.size() && ftruncate(_fd, sizeof(header) + validSize) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	_baseLSN = header.base_lsn;
+	_bufferLSN = _baseLSN + validSize;
+	_flushedLSN = _bufferLSN;
+	_buffer.clear();
+
+	return true;
+}
+
+
+bool PF_Log::Close()
+{
+	bool result = FlushAll();
+
+	if (close(_fd) != 0)
+		result = false;
+	_fd = -1;
+
+	return result;
+}
+
+
+bool PF_Log::ReadRecords(unsigned long long lsn, std::vector<char>& records)
+{
+	// the records already in the file, from the one at lsn on
+	pthread_mutex_lock(&_mutex);
+	lsn = std::min(std::max(lsn, _baseLSN), _flushedLSN);
+	records.resize(_flushedLSN - lsn);
+	bool result = records.empty()
+		|| ReadFromFile(_fd, &records[0], records.size(), sizeof(PF_LogHeader) + (lsn - _baseLSN));
+	pthread_mutex_unlock(&_mutex);
+
+	return result;
+}
+
+
+unsigned long long PF_Log::Append(unsigned type, unsigned long long operationId, unsigned fileId,
+	unsigned long long pageNum, unsigned offset, const void* data, unsigned length)
+{
+	PF_LogRecord record;
+	memset(&record, 0, sizeof(record));
+	record.size = sizeof(record) + length;
+	record.operation_id = operationId;
+	record.type = type;
+	record.file_id = fileId;
+	record.page_num = pageNum;
+	record.offset = offset;
+	record.length = length;
+
+	pthread_mutex_lock(&_mutex);
+
+	size_t start = _buffer.size();
+	record.lsn = _bufferLSN + start;
+	_buffer.resize(start + record.size);
+	memcpy(&_buffer[start], &record, sizeof(record));
+	if (length > 0)
+		memcpy(&_buffer[start + sizeof(record)], data, length);
+
+	unsigned checksum = ComputeChecksum(&_buffer[start], record.size);
+	memcpy(&_buffer[start + offsetof(PF_LogRecord, checksum)], &checksum, sizeof(checksum));
+
+	pthread_mutex_unlock(&_mutex);
+
+	// LSN of the end of the record
+	return record.lsn + record.size;
+}
+
+
+bool PF_Log::Flush(unsigned long long lsn)
+{
+	bool result = true;
+	pthread_mutex_lock(&_mutex);
+	while (_flushedLSN < lsn)
+	{
+		// a flush is in progress; the next one takes our records along
+		if (_isFlushing)
+		{
+			pthread_cond_wait(&_flushDone, &_mutex);
+			continue;
+		}
+
+		// write and sync everything appended so far; appending goes on meanwhile
+		_isFlushing = true;
+		std::vector<char> records;
+		records.swap(_buffer);
+		unsigned long long recordsLSN = _bufferLSN;
+		_bufferLSN += records.size();
+		off_t offset = sizeof(PF_LogHeader) + (recordsLSN - _baseLSN);
+		pthread_mutex_unlock(&_mutex);
+
+		bool isFlushed = WriteToFile(_fd, &records[0], records.size(), offset) && fdatasync(_fd) == 0;
+
+		pthread_mutex_lock(&_mutex);
+		_isFlushing = false;
+		if (isFlushed)
+			_flushedLSN = recordsLSN + records.size();
+		else
+		{
+			// put the records back; they are written again by the next flush
+			records.insert(records.end(), _buffer.begin(), _buffer.end());
+			_buffer.swap(records);
+			_bufferLSN = recordsLSN;
+			result = false;
+		}
+		pthread_cond_broadcast(&_flushDone);
+
+		if (!isFlushed)
+			break;
+	}
+	pthread_mutex_unlock(&_mutex);
+
+	return result;
+}
+
+
+bool PF_Log::FlushAll()
+{
+	return Flush(GetEndLSN());
+}
+
+
+bool PF_Log::Reset()
+{
+	pthread_mutex_lock(&_mutex);
+	while (_isFlushing)
+		pthread_cond_wait(&_flushDone, &_mutex);
+
+	// drop all records; LSNs keep growing so that they stay unique
+	_baseLSN = _bufferLSN + _buffer.size();
+	_bufferLSN = _baseLSN;
+	_flushedLSN = _baseLSN;
+	_buffer.clear();
+
+	bool result = ftruncate(_fd, sizeof(PF_LogHeader)) == 0
+		&& WriteHeader(_fd, _baseLSN)
+		&& fdatasync(_fd) == 0;
+
+	pthread_mutex_unlock(&_mutex);
+
+	return result;
+}
+
+
+bool PF_Log::Truncate(unsigned long long lsn)
+{
+	pthread_mutex_lock(&_mutex);
+	while (_isFlushing)
+		pthread_cond_wait(&_flushDone, &_mutex);
+
+	// only durable records are in the file
+	if (lsn > _flushedLSN)
+		lsn = _flushedLSN;
+	if (lsn <= _baseLSN)
+	{
+		pthread_mutex_unlock(&_mutex);
+		return true;
+	}
+
+	// copy the records still needed into a new log and switch over to it; a
+	// crash before the rename leaves the old log, which has them all as well
+	std::vector<char> records(_flushedLSN - lsn);
+	std::string newFileName = _fileName + ".new";
+	int fd = open(newFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	bool result = fd >= 0
+		&& (records.empty() || ReadFromFile(_fd, &records[0], records.size(), sizeof(PF_LogHeader) + (lsn - _baseLSN)))
+		&& WriteHeader(fd, lsn)
+		&& (records.empty() || WriteToFile(fd, &records[0], records.size(), sizeof(PF_LogHeader)))
+		&& fdatasync(fd) == 0
+		&& rename(newFileName.c_str(), _fileName.c_str()) == 0;
+
+	if (result)
+	{
+		close(_fd);
+		_fd = fd;
+		_baseLSN = lsn;
+	}
+	else if (fd >= 0)
+	{
+		close(fd);
+		unlink(newFileName.c_str());
+	}
+
+	pthread_mutex_unlock(&_mutex);
+
+	return result;
+}
+
+
+unsigned long long PF_Log::GetEndLSN()
+{
+	// LSN of the next record
+	pthread_mutex_lock(&_mutex);
+	unsigned long long lsn = _bufferLSN + _buffer.size();
+	pthread_mutex_unlock(&_mutex);
+
+	return lsn;
+}
+
+
+unsigned long long PF_Log::GetSize()
+{
+	pthread_mutex_lock(&_mutex);
+	unsigned long long size = _bufferLSN + _buffer.size() - _baseLSN;
+	pthread_mutex_unlock(&_mutex);
+
+	return size;
+}
+
+
+bool PF_Log::WriteHeader(int fd, unsigned long long baseLSN)
+{
+	PF_LogHeader header;
+	memset(&header, 0, sizeof(header));
+	strcpy(header.tag, LOG_TAG);
+	header.version = LOG_VERSION;
+	header.base_lsn = baseLSN;
+
+	return WriteToFile(fd, &header, sizeof(header), 0);
+}
+
+
+///////////////////////////////////////////
+// Helper Function Definitions
+///////////////////////////////////////////
+
+bool DoesFileExist(const char* fileName)
+{
+	struct stat stFileInfo;
+
+	if(stat(fileName, &stFileInfo) == 0) return true;
+	else return false;
+}
+
+bool GetFileKey(const char* fileName, PF_FileKey& key)
+{
+	struct stat stFileInfo;
+
+	if (stat(fileName, &stFileInfo) != 0)
+		return false;
+
+	key.device = stFileInfo.st_dev;
+	key.inode = stFileInfo.st_ino;
+	return true;
+}
+
+PF_File* OpenPageFile(const char* fileName, bool isDirectIO)
+{
+	// check that file exists
+	PF_FileKey key;
+	if (!GetFileKey(fileName, key))
+		return NULL;
+
+	// share the file if it is already opened by another handle (in the mode it was opened with)
+	std::map<PF_FileKey, PF_File*>::iterator itr = openedFiles.find(key);
+	if (itr != openedFiles.end())
+	{
+		++itr->second->refCount;
+		return itr->second;
+	}
+
+	int fd = open(fileName, O_RDWR);
+	if (fd < 0)
+		return NULL;
+	struct stat stFileInfo;
+	if (fstat(fd, &stFileInfo) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	// check that the file is a valid page file
+	PF_Header header;
+	off_t dataOffset;
+	if (!ReadHeaderFromFile(fd, header, dataOffset))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	// bypass the kernel page cache; the buffer pool does the caching. Version 1
+	// files have unaligned pages, compressed pages have any length, and some
+	// file systems refuse O_DIRECT: all of them stay buffered
+	bool isCompressed = (header.flags & COMPRESSED_FILE) != 0;
+	if (isDirectIO)
+	{
+		int flags = fcntl(fd, F_GETFL);
+		if (dataOffset % PF_PAGE_SIZE != 0
+			|| isCompressed
+			|| flags < 0
+			|| fcntl(fd, F_SETFL, flags | O_DIRECT) != 0)
+			isDirectIO = false;
+	}
+
+	PF_File* file = new PF_File();
+	file->key = key;
+	file->header = header;
+	file->fd = fd;
+	file->isDirectIO = isDirectIO;
+	file->dataOffset = dataOffset;
+	file->pageSize = header.page_size;
+	file->refCount = 1;
+	file->isFreePageSetLoaded = false;
+	file->numAllocatedPages = 0;
+	if (stFileInfo.st_size > dataOffset)
+		file->numAllocatedPages = (stFileInfo.st_size - dataOffset) / file->pageSize;
+	file->isHeaderDirty = false;
+	file->numDirtyPages = 0;
+	file->firstDirtyTime = 0;
+	file->headerRecLSN = NO_LSN;
+	file->numWritesInProgress = 0;
+	file->stats = &fileStats[fileName];
+	file->isCompressed = isCompressed;
+	file->name = fileName;
+	file->isLogged = false;
+	file->logFileId = 0;
+	if (isCompressed && !LoadPageMap(file))
+	{
+		close(fd);
+		delete file;
+		return NULL;
+	}
+	openedFiles[key] = file;
+
+	return file;
+}
+
+RC ClosePageFile(PF_File* file)
+{
+	if (--file->refCount > 0)
+		return 0;
+
+	// last handle on the file; write back its dirty pages and header and close it.
+	// Logged files are synced too: checkpoints drop their log records. So are
+	// compressed files with moved pages, to write their page map
+	RC result = 0;
+	if (FlushFileData(file) != 0)
+		result = -1;
+	if ((file->isLogged || !file->unsyncedPages.empty()) && SyncPageFile(file) != 0)
+		result = -1;
+
+	openedFiles.erase(file->key);
+	if (close(file->fd) != 0)
+		result = -1;
+	delete file;
+
+	return result;
+}
+
+bool ReadFromFile(int fd, void* data, size_t size, off_t offset)
+{
+	// positional read; does not use or move the file offset
+	char* buffer = reinterpret_cast<char*>(data);
+	while (size > 0)
+	{
+		ssize_t amt_read = pread(fd, buffer, size, offset);
+		if (amt_read < 0 && errno == EINTR)
+			continue;
+		if (amt_read <= 0)
+			return false;
+
+		buffer += amt_read;
+		size -= amt_read;
+		offset += amt_read;
+	}
+
+	return true;
+}
+
+bool WriteToFile(int fd, const void* data, size_t size, off_t offset)
+{
+	// positional write; does not use or move the file offset
+	const char* buffer = reinterpret_cast<const char*>(data);
+	while (size > 0)
+	{
+		ssize_t amt_written = pwrite(fd, buffer, size, offset);
+		if (amt_written < 0 && errno == EINTR)
+			continue;
+		if (amt_written <= 0)
+			return false;
+
+		buffer += amt_written;
+		size -= amt_written;
+		offset += amt_written;
+	}
+
+	return true;
+}
+
+bool ReadHeaderFromFile(int fd, PF_Header& header, off_t& dataOffset)
+{
+	// both header versions keep the tag at the same offset
+	PF_Header_V1 headerV1;
+	if (!ReadFromFile(fd, &headerV1, sizeof(headerV1), 0))
+		return false;
+
+	if (strcmp(headerV1.tag, TAG) == 0)
+	{
+		header = PF_Header();
+		header.version = VERSION_1;		// no free page list
+		header.num_pages = headerV1.num_pages;
+		dataOffset = sizeof(PF_Header_V1);
+		return true;
+	}
+
+	if (strcmp(headerV1.tag, LARGE_TAG) != 0)
+		return false;
+
+	if (!ReadFromFile(fd, &header, sizeof(header), 0))
+		return false;
+	if (header.version < VERSION_LARGE || header.version > CURRENT_VERSION)
+		return false;
+
+	// the header page has the size of the data pages
+	if (header.page_size == 0)
+		header.page_size = PF_PAGE_SIZE;
+	if (!IsValidPageSize(header.page_size))
+		return false;
+	if ((header.flags & ~COMPRESSED_FILE) != 0)
+		return false;	// written by a newer version
+
+	dataOffset = header.page_size;
+	return true;
+}
+
+bool WriteHeaderToFile(PF_File* file)
+{
+	++globalStats.headerWrites;
+	++file->stats->headerWrites;
+
+	const PF_Header& header = file->header;
+	if (header.version == VERSION_1)
+	{
+		PF_Header_V1 headerV1;
+		memset(&headerV1, 0, sizeof(headerV1));
+		assert(header.num_pages <= 0xFFFFFFFFULL);
+		headerV1.num_pages = static_cast<unsigned int>(header.num_pages);
+		strcpy(headerV1.tag, TAG);
+		return WriteToFile(file->fd, &headerV1, sizeof(headerV1), 0);
+	}
+
+	// direct I/O can only write the header page as a whole
+	if (file->isDirectIO)
+	{
+		char* headerPage = GetBouncePage();
+		memset(headerPage, 0, file->pageSize);
+		memcpy(headerPage, &header, sizeof(header));
+		return WriteToFile(file->fd, headerPage, file->pageSize, 0);
+	}
+
+	// compressed files keep the page map chunk table right after the header
+	if (file->isCompressed)
+	{
+		std::vector<char> headerData(sizeof(header) + file->mapChunks.size() * sizeof(unsigned long long));
+		memcpy(&headerData[0], &header, sizeof(header));
+		if (!file->mapChunks.empty())
+			memcpy(&headerData[sizeof(header)], &file->mapChunks[0], file->mapChunks.size() * sizeof(unsigned long long));
+		return WriteToFile(file->fd, &headerData[0], headerData.size(), 0);
+	}
+
+	return WriteToFile(file->fd, &header, sizeof(header), 0);
+}
+
+bool IsValidPageSize(unsigned pageSize)
+{
+	// a power of two multiple of PF_PAGE_SIZE (4K, 8K, ..., 64K)
+	if (pageSize < PF_PAGE_SIZE || pageSize > MAX_PAGE_SIZE)
+		return false;
+
+	return pageSize % PF_PAGE_SIZE == 0 && (pageSize & (pageSize - 1)) == 0;
+}
+
+bool IsPageAligned(const void* data)
+{
+	return reinterpret_cast<unsigned long>(data) % PF_PAGE_SIZE == 0;
+}
+
+char* GetBouncePage()
+{
+	// page-aligned staging buffer for direct I/O transfers of unaligned data;
+	// large enough for pages of any size
+	static char* bouncePage = NULL;
+	if (bouncePage == NULL)
+	{
+		void* page = NULL;
+		int alloc_result = posix_memalign(&page, PF_PAGE_SIZE, MAX_PAGE_SIZE);
+		assert(alloc_result == 0);
+		bouncePage = reinterpret_cast<char*>(page);
+	}
+
+	return bouncePage;
+}
+
+off_t GetPageOffset(const PF_File* file, PageNum pageNum)
+{
+	return file->dataOffset + static_cast<off_t>(pageNum) * file->pageSize;
+}
+
+RC ReadPageFromFile(PF_File* file, PageNum pageNum, void* data)
+{
+	CountPageIO(file, false, 1);
+
+	if (file->isCompressed)
+		return ReadCompressedPage(file, pageNum, data);
+
+	// direct I/O reads unaligned destinations through the bounce page
+	void* buffer = data;
+	if (file->isDirectIO && !IsPageAligned(data))
+		buffer = GetBouncePage();
+
+	// read page
+	if (!ReadFromFile(file->fd, buffer, file->pageSize, GetPageOffset(file, pageNum)))
+		return -1;	// return error
+
+	if (buffer != data)
+		memcpy(data, buffer, file->pageSize);
+
+	return 0;
+}
+
+RC WritePageToFile(PF_File* file, PageNum pageNum, const void* data)
+{
+	CountPageIO(file, true, 1);
+
+	if (file->isCompressed)
+		return WriteCompressedPage(file, pageNum, data);
+
+	// direct I/O writes unaligned sources through the bounce page
+	const void* buffer = data;
+	if (file->isDirectIO && !IsPageAligned(data))
+	{
+		memcpy(GetBouncePage(), data, file->pageSize);
+		buffer = GetBouncePage();
+	}
+
+	// write page
+	if (!WriteToFile(file->fd, buffer, file->pageSize, GetPageOffset(file, pageNum)))
+		return -1;	// return error
+
+	return 0;
+}
+
+bool TransferVector(int fd, bool isWrite, struct iovec* iov, int iovcnt, off_t offset)
+{
+	while (iovcnt > 0)
+	{
+		ssize_t amt_transferred = isWrite ? pwritev(fd, iov, iovcnt, offset) : preadv(fd, iov, iovcnt, offset);
+		if (amt_transferred < 0 && errno == EINTR)
+			continue;
+		if (amt_transferred <= 0)
+			return false;
+		offset += amt_transferred;
+
+		// skip the buffers done; continue within a partially transferred one
+		size_t amt_left = amt_transferred;
+		while (iovcnt > 0 && amt_left >= iov->iov_len)
+		{
+			amt_left -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt > 0)
+		{
+			iov->iov_base = reinterpret_cast<char*>(iov->iov_base) + amt_left;
+			iov->iov_len -= amt_left;
+		}
+	}
+
+	return true;
+}
+
+RC TransferPageRuns(PF_File* file, bool isWrite, const std::vector<std::pair<PageNum, unsigned> >& pages, void* const* data)
+{
+	// pages are sorted by page number; each run of consecutive pages takes one
+	// system call per MAX_VECTOR_PAGES pages
+	std::vector<struct iovec> iov;
+	for (size_t i = 0; i < pages.size(); i += iov.size())
+	{
+		iov.clear();
+		while (i + iov.size() < pages.size() && iov.size() < MAX_VECTOR_PAGES)
+		{
+			const std::pair<PageNum, unsigned>& page = pages[i + iov.size()];
+			if (!iov.empty() && page.first != pages[i].first + iov.size())
+				break;
+
+			struct iovec pageVector;
+			pageVector.iov_base = data[page.second];
+			pageVector.iov_len = file->pageSize;
+			iov.push_back(pageVector);
+		}
+
+		if (!TransferVector(file->fd, isWrite, &iov[0], iov.size(), GetPageOffset(file, pages[i].first)))
+			return -1;	// return error
+	}
+
+	return 0;
+}
+
+RC AllocateExtent(PF_File* file, PageNum numPages)
+{
+	// compressed pages are placed through the page map instead
+	if (numPages <= file->numAllocatedPages || file->isCompressed)
+		return 0;
+
+	// extents grow with the file: 1/8 of its size, within [MIN_EXTENT_PAGES, MAX_EXTENT_PAGES]
+	// (counted in PF_PAGE_SIZE pages, so large pages get extents of the same size in bytes)
+	unsigned pageScale = file->pageSize / PF_PAGE_SIZE;
+	PageNum extentPages = file->numAllocatedPages / 8;
+	if (extentPages < MIN_EXTENT_PAGES / pageScale)
+		extentPages = MIN_EXTENT_PAGES / pageScale;
+	if (extentPages > MAX_EXTENT_PAGES / pageScale)
+		extentPages = MAX_EXTENT_PAGES / pageScale;
+
+	PageNum numNewPages = numPages - file->numAllocatedPages;
+	if (numNewPages < extentPages)
+		numNewPages = extentPages;
+
+	// reserve contiguous space for the extent; a failure only means the
+	// file keeps growing page by page through the writes themselves
+	off_t offset = GetPageOffset(file, file->numAllocatedPages);
+	off_t length = static_cast<off_t>(numNewPages) * file->pageSize;
+	if (posix_fallocate(file->fd, offset, length) != 0)
+		return 0;
+
+	file->numAllocatedPages += numNewPages;
+	return 0;
+}
+
+RC FlushFileData(PF_File* file)
+{
+	if (!file->HasPendingWrites() && file->numWritesInProgress == 0)
+		return 0;	// nothing to write
+
+	unsigned long long startTime = GetMicroseconds();
+	RC result = 0;
+
+	// write-ahead rule: the log records of the pages and header go first
+	if (file->isLogged && file->HasPendingWrites() && !writeAheadLog->FlushAll())
+		result = -1;
+
+	// pages first, so that the header never counts pages that are not written
+	else if (!bufferPool->FlushFile(file))
+		result = -1;
+
+	else if (file->isHeaderDirty)
+	{
+		if (WriteHeaderToFile(file))
+			file->isHeaderDirty = false;
+		else
+			result = -1;
+	}
+
+	RecordLatency(file, &PF_IOStats::flush, startTime);
+	return result;
+}
+
+RC FlushFileDataOverThreshold(PF_File* file)
+{
+	if (file->numDirtyPages >= maxDirtyPages
+		|| (file->HasPendingWrites()
+			&& difftime(time(NULL), file->firstDirtyTime) >= maxDirtySeconds))
+	{
+		// the background writer catches up instead; the caller does not wait for the disk
+		if (isWriterRunning)
+		{
+			pthread_cond_signal(&writerWakeup);
+			return 0;
+		}
+
+		return FlushFileData(file);
+	}
+
+	return 0;
+}
+
+void FlushAllFilesAtExit()
+{
+	StopBackgroundWriter();
+
+	PF_PoolLock lock;
+	std::map<PF_FileKey, PF_File*>::iterator itr;
+	for (itr = openedFiles.begin(); itr != openedFiles.end(); ++itr)
+		FlushFileData(itr->second);
+}
+
+void CompleteReadAhead(PF_FileHandle_Data& handle, bool isWaiting)
+{
+	if (handle.readAheadFrames.empty())
+		return;
+
+	// without waiting, only a batch that is all in is completed
+	if (!isWaiting)
+	{
+		handle.readAheadIO->Reap(false);
+		if (handle.readAheadIO->GetNumPending() > 0)
+			return;
+	}
+
+	// the pages of a failed batch are dropped and read again on demand
+	bool isRead = handle.readAheadIO->WaitAll();
+	for (unsigned i = 0; i < handle.readAheadFrames.size(); ++i)
+	{
+		PF_Frame& frame = bufferPool->GetFrame(handle.readAheadFrames[i]);
+		frame.readAhead = NULL;
+		--frame.pinCount;
+		if (!isRead)
+			bufferPool->ReleaseFrame(handle.readAheadFrames[i]);
+	}
+	handle.readAheadFrames.clear();
+}
+
+RC ReadPageThroughPool(PF_File* file, PageNum pageNum, void* data, PF_AccessRing* ring, bool isUnlockAllowed)
+{
+	// serve from the buffer pool
+	unsigned frameIndex = bufferPool->FindFrame(file->key, pageNum);
+	if (frameIndex == INVALID_FRAME)
+	{
+		++globalStats.cacheMisses;
+		++file->stats->cacheMisses;
+
+		frameIndex = bufferPool->AllocateFrame(file->key, pageNum, file->pageSize, ring, isUnlockAllowed);
+
+		// all frames are pinned; bypass the buffer pool
+		if (frameIndex == INVALID_FRAME)
+			return ReadPageFromFile(file, pageNum, data);
+
+		if (isUnlockAllowed)
+		{
+			if (bufferPool->GetFrame(frameIndex).isReadInProgress && LoadFrame(file, frameIndex, true) != 0)
+				return -1;
+		}
+		else if (ReadPageFromFile(file, pageNum, bufferPool->GetFrame(frameIndex).data) != 0)
+		{
+			bufferPool->ReleaseFrame(frameIndex);
+			return -1;
+		}
+	}
+	else
+	{
+		++globalStats.cacheHits;
+		++file->stats->cacheHits;
+	}
+
+	PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+	frame.isReferenced = true;
+	memcpy(data, frame.data, file->pageSize);
+
+	return 0;
+}
+
+RC WritePageThroughPool(PF_File* file, PageNum pageNum, const void* data, PF_AccessRing* ring, bool isUnlockAllowed)
+{
+	// keep the buffer pool up to date
+	unsigned frameIndex = bufferPool->FindFrame(file->key, pageNum);
+	if (frameIndex == INVALID_FRAME)
+	{
+		frameIndex = bufferPool->AllocateFrame(file->key, pageNum, file->pageSize, ring, isUnlockAllowed);
+
+		// logged files log the change against the old contents
+		if (frameIndex != INVALID_FRAME && isUnlockAllowed)
+		{
+			if (bufferPool->GetFrame(frameIndex).isReadInProgress && LoadFrame(file, frameIndex, file->isLogged) != 0)
+				return -1;
+		}
+		else if (frameIndex != INVALID_FRAME && file->isLogged
+			&& ReadPageFromFile(file, pageNum, bufferPool->GetFrame(frameIndex).data) != 0)
+		{
+			bufferPool->ReleaseFrame(frameIndex);
+			return -1;
+		}
+	}
+	if (frameIndex != INVALID_FRAME)
+	{
+		PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+		unsigned long long recLSN = GetLogEndLSN(file);
+		if (file->isLogged)
+			LogPageChange(file, pageNum, frame.data, reinterpret_cast<const char*>(data));
+		memcpy(frame.data, data, file->pageSize);
+		frame.isReferenced = true;
+
+		// write-back mode and logged files: defer the write until Sync(), CloseFile() or a threshold
+		if (IsWriteDeferred(file))
+		{
+			bufferPool->MarkFrameDirty(frameIndex, file, recLSN);
+			return FlushFileDataOverThreshold(file);
+		}
+
+		bufferPool->MarkFrameClean(frameIndex);
+	}
+	else if (file->isLogged)
+	{
+		// all frames are pinned; log the change against the page in the file and make it durable first
+		std::vector<char> oldData(file->pageSize);
+		if (ReadPageFromFile(file, pageNum, &oldData[0]) != 0)
+			return -1;
+		LogPageChange(file, pageNum, &oldData[0], reinterpret_cast<const char*>(data));
+		if (!writeAheadLog->FlushAll())
+			return -1;
+	}
+
+	// write page
+	if (WritePageToFile(file, pageNum, data) != 0)
+		return -1;	// return error
+
+	return 0;
+}
+
+RC LoadFrame(PF_File* file, unsigned frameIndex, bool isReading)
+{
+	// read the page into a frame that AllocateFrame() handed out for it; the
+	// other page misses and evictions go on meanwhile. Compressed pages are
+	// located through the page map, under the lock
+	PF_Frame& frame = bufferPool->GetFrame(frameIndex);
+	RC result = 0;
+	if (isReading && file->isCompressed)
+		result = ReadPageFromFile(file, frame.pageNum, frame.data);
+	else if (isReading)
+	{
+		off_t offset = GetPageOffset(file, frame.pageNum);
+		CountPageIO(file, false, 1);
+		pthread_mutex_unlock(&poolMutex);
+		bool isRead = ReadFromFile(file->fd, frame.data, file->pageSize, offset);
+		pthread_mutex_lock(&poolMutex);
+		result = isRead ? 0 : -1;
+	}
+
+	// the frame is pinned while it is read; a failed read drops the page
+	frame.isReadInProgress = false;
+	--frame.pinCount;
+	if (result != 0)
+		bufferPool->ReleaseFrame(frameIndex);
+	pthread_cond_broadcast(&writesDone);
+
+	return result;
+}
+
+RC AppendPageToFile(PF_File* file, const void* data, PageNum& pageNum, PF_AccessRing* ring)
+{
+	// reuse a deallocated page before growing the file
+	PF_Header& header = file->header;
+	if (header.num_free_pages > 0)
+	{
+		pageNum = static_cast<PageNum>(header.free_list_head);
+		if (pageNum >= header.num_pages)
+			return -1;	// the free page list is corrupt
+
+		PF_FreePage freePage;
+		char* pageData = GetBouncePage();
+		if (ReadPageThroughPool(file, pageNum, pageData, ring, false) != 0)
+			return -1;
+		memcpy(&freePage, pageData, sizeof(freePage));
+		if (memcmp(freePage.tag, FREE_PAGE_TAG, sizeof(FREE_PAGE_TAG)) != 0)
+			return -1;	// the free page list is corrupt; leave it for the caller to notice
+
+		// unlink the page before reusing it; a crash in between only leaks the page
+		header.free_list_head = freePage.next_free_page;
+		header.num_free_pages -= 1;
+		file->freePages.erase(pageNum);
+		if (UpdateHeader(file) != 0)
+			return -1;
+
+		return WritePageThroughPool(file, pageNum, data, ring, false);
+	}
+
+	// grow the file by a whole extent when it is full
+	pageNum = header.num_pages;
+	if (AllocateExtent(file, pageNum + 1) != 0)
+		return -1;
+
+	unsigned long long recLSN = GetLogEndLSN(file);
+	if (file->isLogged)
+		writeAheadLog->Append(LOG_PAGE_IMAGE, BeginOperation(), file->logFileId, pageNum, 0, data, file->pageSize);
+
+	// appended pages are usually written again right away; cache them
+	unsigned frameIndex = bufferPool->FindFrame(file->key, pageNum);
+	if (frameIndex == INVALID_FRAME)
+		frameIndex = bufferPool->AllocateFrame(file->key, pageNum, file->pageSize, ring, false);
+	if (frameIndex != INVALID_FRAME)
+	{
+		memcpy(bufferPool->GetFrame(frameIndex).data, data, file->pageSize);
+
+		// write-back mode and logged files: the page and the header are written later
+		if (IsWriteDeferred(file))
+		{
+			bufferPool->MarkFrameDirty(frameIndex, file, recLSN);
+			header.num_pages += 1;
+			return UpdateHeader(file);
+		}
+
+		bufferPool->MarkFrameClean(frameIndex);
+	}
+
+	// write page after the last page (after its log record)
+	if ((file->isLogged && !writeAheadLog->FlushAll())
+		|| WritePageToFile(file, pageNum, data) != 0)
+	{
+		if (frameIndex != INVALID_FRAME)
+			bufferPool->ReleaseFrame(frameIndex);
+		return -1;	// return error
+	}
+
+	// update and write header
+	header.num_pages += 1;
+	return UpdateHeader(file);
+}
+
+RC UpdateHeader(PF_File* file)
+{
+	unsigned long long recLSN = GetLogEndLSN(file);
+	if (file->isLogged)
+		LogHeaderChange(file);
+
+	if (IsWriteDeferred(file))
+	{
+		if (!file->isHeaderDirty)
+			file->headerRecLSN = recLSN;
+		file->SetHeaderDirty();
+		return FlushFileDataOverThreshold(file);
+	}
+
+	return WriteHeaderToFile(file) ? 0 : -1;
+}
+
+bool LoadFreePageSet(PF_File* file)
+{
+	if (file->isFreePageSetLoaded)
+		return true;
+
+	// walk the free page chain
+	file->freePages.clear();
+	PageNum pageNum = static_cast<PageNum>(file->header.free_list_head);
+	PF_FreePage freePage;
+	char* pageData = GetBouncePage();
+	for (unsigned long long i = 0; i < file->header.num_free_pages; ++i)
+	{
+		if (pageNum >= file->header.num_pages
+			|| ReadPageThroughPool(file, pageNum, pageData, NULL, false) != 0)
+			return false;
+
+		memcpy(&freePage, pageData, sizeof(freePage));
+		if (strcmp(freePage.tag, FREE_PAGE_TAG) != 0)
+			return false;	// corrupted chain
+
+		file->freePages.insert(pageNum);
+		pageNum = static_cast<PageNum>(freePage.next_free_page);
+	}
+
+	file->isFreePageSetLoaded = true;
+	return true;
+}
+
+// LZ77 in a format close to the LZ4 block format: each sequence is a token
+// (literal length << 4 | match length - LZ_MIN_MATCH), the extra bytes of a
+// literal length of 15 or more, the literals, a 2-byte little-endian match
+// offset and the extra bytes of the match length. The last sequence has
+// literals only. Returns 0 if the result does not fit into capacity
+unsigned CompressPage(const char* src, unsigned size, char* dst, unsigned capacity)
+{
+	const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+	unsigned char* out = reinterpret_cast<unsigned char*>(dst);
+
+	// last position of each hashed 4-byte sequence
+	unsigned hashTable[1 << LZ_HASH_BITS];
+	memset(hashTable, 0, sizeof(hashTable));
+
+	unsigned inPos = 0;
+	unsigned outPos = 0;
+	unsigned anchor = 0;		// first literal of the current sequence
+	while (true)
+	{
+		// find the next match
+		unsigned matchPos = 0;
+		unsigned matchLength = 0;
+		while (inPos + LZ_MIN_MATCH <= size)
+		{
+			unsigned sequence;
+			memcpy(&sequence, in + inPos, sizeof(sequence));
+			unsigned hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+			unsigned candidate = hashTable[hash];
+			hashTable[hash] = inPos;
+
+			if (candidate < inPos && inPos - candidate <= LZ_MAX_OFFSET
+				&& memcmp(in + candidate, in + inPos, LZ_MIN_MATCH) == 0)
+			{
+				matchPos = candidate;
+				matchLength = LZ_MIN_MATCH;
+				while (inPos + matchLength < size && in[candidate + matchLength] == in[inPos + matchLength])
+					++matchLength;
+				break;
+			}
+			++inPos;
+		}
+		if (matchLength == 0)
+			inPos = size;
+
+		// check that the sequence fits
+		unsigned literalLength = inPos - anchor;
+		unsigned needed = 1 + literalLength;
+		if (literalLength >= 15)
+			needed += (literalLength - 15) / 255 + 1;
+		if (matchLength > 0)
+		{
+			needed += 2;
+			if (matchLength - LZ_MIN_MATCH >= 15)
+				needed += (matchLength - LZ_MIN_MATCH - 15) / 255 + 1;
+		}
+		if (needed > capacity - outPos)
+			return 0;
+
+		// write the sequence
+		unsigned literalCode = std::min(literalLength, 15U);
+		unsigned matchCode = matchLength > 0 ? std::min(matchLength - LZ_MIN_MATCH, 15U) : 0;
+		out[outPos++] = static_cast<unsigned char>(literalCode << 4 | matchCode);
+		if (literalCode == 15)
+		{
+			unsigned rest = literalLength - 15;
+			for (; rest >= 255; rest -= 255)
+				out[outPos++] = 255;
+			out[outPos++] = static_cast<unsigned char>(rest);
+		}
+		memcpy(out + outPos, in + anchor, literalLength);
+		outPos += literalLength;
+
+		if (matchLength == 0)
+			return outPos;
+
+		unsigned offset = inPos - matchPos;
+		out[outPos++] = static_cast<unsigned char>(offset & 0xFF);
+		out[outPos++] = static_cast<unsigned char>(offset >> 8);
+		if (matchCode == 15)
+		{
+			unsigned rest = matchLength - LZ_MIN_MATCH - 15;
+			for (; rest >= 255; rest -= 255)
+				out[outPos++] = 255;
+			out[outPos++] = static_cast<unsigned char>(rest);
+		}
+
+		inPos += matchLength;
+		anchor = inPos;
+	}
+}
+
+bool DecompressPage(const char* src, unsigned length, char* dst, unsigned size)
+{
+	const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+	unsigned char* out = reinterpret_cast<unsigned char*>(dst);
+
+	unsigned inPos = 0;
+	unsigned outPos = 0;
+	while (inPos < length)
+	{
+		unsigned token = in[inPos++];
+
+		// literals
+		unsigned literalLength = token >> 4;
+		if (literalLength == 15)
+		{
+			unsigned char extra;
+			do
+			{
+				if (inPos >= length)
+					return false;
+				extra = in[inPos++];
+				literalLength += extra;
+			} while (extra == 255);
+		}
+		if (literalLength > length - inPos || literalLength > size - outPos)
+			return false;
+		memcpy(out + outPos, in + inPos, literalLength);
+		inPos += literalLength;
+		outPos += literalLength;
+
+		// the last sequence has no match
+		if (inPos == length)
+			break;
+
+		if (length - inPos < 2)
+			return false;
+		unsigned offset = in[inPos] | (in[inPos + 1] << 8);
+		inPos += 2;
+
+		unsigned matchLength = token & 0x0F;
+		if (matchLength == 15)
+		{
+			unsigned char extra;
+			do
+			{
+				if (inPos >= length)
+					return false;
+				extra = in[inPos++];
+				matchLength += extra;
+			} while (extra == 255);
+		}
+		matchLength += LZ_MIN_MATCH;
+		if (offset == 0 || offset > outPos || matchLength > size - outPos)
+			return false;
+
+		// byte by byte: a match may overlap the bytes it produces
+		for (unsigned i = 0; i < matchLength; ++i, ++outPos)
+			out[outPos] = out[outPos - offset];
+	}
+
+	return outPos == size;
+}
+
+char* GetCompressionBuffer()
+{
+	static char* buffer = NULL;
+	if (buffer == NULL)
+		buffer = reinterpret_cast<char*>(malloc(MAX_PAGE_SIZE));
+
+	return buffer;
+}
+
+bool LoadPageMap(PF_File* file)
+{
+	PF_Header& header = file->header;
+	unsigned maxMapChunks = (file->pageSize - sizeof(PF_Header)) / sizeof(unsigned long long);
+	if (header.num_map_chunks > maxMapChunks)
+		return false;
+
+	// page map chunk table
+	file->mapChunks.resize(header.num_map_chunks);
+	if (header.num_map_chunks > 0
+		&& !ReadFromFile(file->fd, &file->mapChunks[0], header.num_map_chunks * sizeof(unsigned long long), sizeof(PF_Header)))
+		return false;
+
+	// page map
+	const unsigned long long chunkSectors = MAP_CHUNK_ENTRIES * sizeof(PF_PageExtent) / SECTOR_SIZE;
+	file->pageMap.resize(static_cast<size_t>(header.num_map_chunks) * MAP_CHUNK_ENTRIES);
+	std::vector<std::pair<unsigned long long, unsigned long long> > usedSectors;
+	for (unsigned i = 0; i < header.num_map_chunks; ++i)
+	{
+		if (!ReadFromFile(file->fd, &file->pageMap[i * MAP_CHUNK_ENTRIES], MAP_CHUNK_ENTRIES * sizeof(PF_PageExtent),
+				file->mapChunks[i] * SECTOR_SIZE))
+			return false;
+		usedSectors.push_back(std::make_pair(file->mapChunks[i], chunkSectors));
+	}
+	for (size_t i = 0; i < file->pageMap.size(); ++i)
+	{
+		if (file->pageMap[i].numSectors > 0)
+			usedSectors.push_back(std::make_pair(file->pageMap[i].sector, file->pageMap[i].numSectors));
+	}
+
+	// the gaps between the used sectors are free
+	std::sort(usedSectors.begin(), usedSectors.end());
+	file->freeSectors.clear();
+	file->endSector = file->pageSize / SECTOR_SIZE;		// past the header page
+	for (size_t i = 0; i < usedSectors.size(); ++i)
+	{
+		if (usedSectors[i].first < file->endSector)
+			return false;	// overlapping extents
+		if (usedSectors[i].first > file->endSector)
+			file->freeSectors[file->endSector] = usedSectors[i].first - file->endSector;
+		file->endSector = usedSectors[i].first + usedSectors[i].second;
+	}
+
+	return true;
+}
+
+RC ReadCompressedPage(PF_File* file, PageNum pageNum, void* data)
+{
+	// pages that were never written read as zeros
+	if (pageNum >= file->pageMap.size() || file->pageMap[pageNum].numSectors == 0)
+	{
+		memset(data, 0, file->pageSize);
+		return 0;
+	}
+
+	const PF_PageExtent& extent = file->pageMap[pageNum];
+	off_t offset = static_cast<off_t>(extent.sector) * SECTOR_SIZE;
+	if (extent.length == file->pageSize)
+		return ReadFromFile(file->fd, data, file->pageSize, offset) ? 0 : -1;
+
+	char* buffer = GetCompressionBuffer();
+	if (!ReadFromFile(file->fd, buffer, extent.length, offset))
+		return -1;	// return error
+	if (!DecompressPage(buffer, extent.length, reinterpret_cast<char*>(data), file->pageSize))
+		return -1;	// corrupted page
+
+	return 0;
+}
+
+RC WriteCompressedPage(PF_File* file, PageNum pageNum, const void* data)
+{
+	// store the page uncompressed unless compression saves at least a sector
+	char* buffer = GetCompressionBuffer();
+	unsigned length = CompressPage(reinterpret_cast<const char*>(data), file->pageSize, buffer, file->pageSize - SECTOR_SIZE);
+	const void* storedData = buffer;
+	if (length == 0)
+	{
+		length = file->pageSize;
+		storedData = data;
+	}
+	unsigned numSectors = (length + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+	// add page map chunks up to the page
+	const unsigned long long chunkSectors = MAP_CHUNK_ENTRIES * sizeof(PF_PageExtent) / SECTOR_SIZE;
+	unsigned chunkIndex = pageNum / MAP_CHUNK_ENTRIES;
+	unsigned maxMapChunks = (file->pageSize - sizeof(PF_Header)) / sizeof(unsigned long long);
+	while (file->mapChunks.size() <= chunkIndex)
+	{
+		if (file->mapChunks.size() >= maxMapChunks)
+			return -1;	// page map is full
+
+		unsigned long long chunkSector = AllocateSectors(file, chunkSectors);
+		std::vector<PF_PageExtent> chunk(MAP_CHUNK_ENTRIES);
+		memset(&chunk[0], 0, chunk.size() * sizeof(PF_PageExtent));
+		// the header must not name the chunk before it is durable
+		if (!WriteToFile(file->fd, &chunk[0], chunk.size() * sizeof(PF_PageExtent), chunkSector * SECTOR_SIZE)
+			|| fdatasync(file->fd) != 0)
+		{
+			FreeSectors(file, chunkSector, chunkSectors);
+			return -1;	// return error
+		}
+
+		file->mapChunks.push_back(chunkSector);
+		file->pageMap.resize(file->mapChunks.size() * MAP_CHUNK_ENTRIES);
+		file->header.num_map_chunks = file->mapChunks.size();
+		if (!WriteHeaderToFile(file))
+			return -1;	// return error
+	}
+
+	// always write the page to new sectors; a crash in the middle of the write
+	// must leave the copy the page map on disk points to intact
+	PF_PageExtent oldExtent = file->pageMap[pageNum];
+	PF_PageExtent extent;
+	extent.sector = AllocateSectors(file, numSectors);
+	extent.length = length;
+	extent.numSectors = numSectors;
+	if (!WriteToFile(file->fd, storedData, length, static_cast<off_t>(extent.sector) * SECTOR_SIZE))
+	{
+		FreeSectors(file, extent.sector, extent.numSectors);
+		return -1;	// return error
+	}
+	file->pageMap[pageNum] = extent;
+
+	// the page map on disk is updated once the new copy is synced (see
+	// SyncPageFile()); until then its old sectors stay reserved. A copy
+	// written since the last sync is not in the map on disk and is freed now
+	std::map<PageNum, PF_PageExtent>::iterator itr = file->unsyncedPages.find(pageNum);
+	if (itr == file->unsyncedPages.end())
+		file->unsyncedPages[pageNum] = oldExtent;
+	else if (oldExtent.numSectors > 0)
+		FreeSectors(file, oldExtent.sector, oldExtent.numSectors);
+
+	// bound the sectors held by the old copies
+	if (file->unsyncedPages.size() >= MAX_UNSYNCED_PAGES)
+		return SyncPageFile(file);
+
+	return 0;
+}
+
+bool WritePageMapEntries(PF_File* file)
+{
+	// the new copies of the moved pages are durable; point the page map on disk at them
+	std::map<PageNum, PF_PageExtent>::iterator itr;
+	for (itr = file->unsyncedPages.begin(); itr != file->unsyncedPages.end(); ++itr)
+	{
+		PageNum pageNum = itr->first;
+		off_t entryOffset = static_cast<off_t>(file->mapChunks[pageNum / MAP_CHUNK_ENTRIES]) * SECTOR_SIZE
+			+ static_cast<off_t>(pageNum % MAP_CHUNK_ENTRIES) * sizeof(PF_PageExtent);
+		if (!WriteToFile(file->fd, &file->pageMap[pageNum], sizeof(PF_PageExtent), entryOffset))
+			return false;
+	}
+	if (fdatasync(file->fd) != 0)
+		return false;
+
+	// no crash can bring the old copies back now
+	for (itr = file->unsyncedPages.begin(); itr != file->unsyncedPages.end(); ++itr)
+	{
+		if (itr->second.numSectors > 0)
+			FreeSectors(file, itr->second.sector, itr->second.numSectors);
+	}
+	file->unsyncedPages.clear();
+
+	return true;
+}
+
+RC SyncPageFile(PF_File* file)
+{
+	if (fdatasync(file->fd) != 0)
+		return -1;
+
+	// compressed files: the page map is written after the pages it points to
+	if (!file->unsyncedPages.empty() && !WritePageMapEntries(file))
+		return -1;
+
+	return 0;
+}
+
+unsigned long long AllocateSectors(PF_File* file, unsigned long long numSectors)
+{
+	// first fit among the free sectors
+	std::map<unsigned long long, unsigned long long>::iterator itr;
+	for (itr = file->freeSectors.begin(); itr != file->freeSectors.end(); ++itr)
+	{
+		if (itr->second < numSectors)
+			continue;
+
+		unsigned long long sector = itr->first;
+		unsigned long long rest = itr->second - numSectors;
+		file->freeSectors.erase(itr);
+		if (rest > 0)
+			file->freeSectors[sector + numSectors] = rest;
+		return sector;
+	}
+
+	// grow the file
+	unsigned long long sector = file->endSector;
+	file->endSector += numSectors;
+	return sector;
+}
+
+void FreeSectors(PF_File* file, unsigned long long sector, unsigned long long numSectors)
+{
+	// merge with the following free sectors
+	std::map<unsigned long long, unsigned long long>::iterator next = file->freeSectors.find(sector + numSectors);
+	if (next != file->freeSectors.end())
+	{
+		numSectors += next->second;
+		file->freeSectors.erase(next);
+	}
+
+	// merge with the preceding free sectors
+	std::map<unsigned long long, unsigned long long>::iterator prev = file->freeSectors.lower_bound(sector);
+	if (prev != file->freeSectors.begin())
+	{
+		--prev;
+		if (prev->first + prev->second == sector)
+		{
+			sector = prev->first;
+			numSectors += prev->second;
+			file->freeSectors.erase(prev);
+		}
+	}
+
+	// sectors at the end of the file are reused by growing it again
+	if (sector + numSectors == file->endSector)
+	{
+		file->endSector = sector;
+		return;
+	}
+
+	file->freeSectors[sector] = numSectors;
+}
+
+bool IsWriteDeferred(const PF_File* file)
+{
+	// logged files can be written back lazily; the log has their changes
+	return isWriteBackEnabled || isWriterRunning || file->isLogged;
+}
+
+unsigned long long GetLogEndLSN(const PF_File* file)
+{
+	// where the next log record of the file goes, if it is logged
+	return file->isLogged ? writeAheadLog->GetEndLSN() : NO_LSN;
+}
+
+void* RunBackgroundWriter(void*)
+{
+	PF_PoolLock lock;
+	while (!isWriterStopping)
+	{
+		// run a round every WRITER_INTERVAL_MS, or as soon as a file goes over the write-back thresholds
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (WRITER_INTERVAL_MS % 1000) * 1000000L;
+		deadline.tv_sec += WRITER_INTERVAL_MS / 1000 + deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&writerWakeup, &poolMutex, &deadline);
+		if (isWriterStopping)
+			break;
+
+		// failed writes are retried in the next round; the foreground
+		// reports them if they still fail when it flushes
+		bufferPool->WriteDirtyPages(writerPages);
+		WriteDirtyHeaders();
+
+		if (writeAheadLog != NULL
+			&& (difftime(time(NULL), lastCheckpointTime) >= checkpointSeconds
+				|| writeAheadLog->GetSize() >= CHECKPOINT_LOG_SIZE))
+			TakeCheckpoint();
+	}
+
+	return NULL;
+}
+
+RC StopBackgroundWriter()
+{
+	{
+		PF_PoolLock lock;
+		if (!isWriterRunning || isWriterStopping)
+			return 0;
+
+		isWriterStopping = true;
+		pthread_cond_signal(&writerWakeup);
+	}
+
+	// the writer needs the lock to finish its round
+	assert(poolLockDepth == 0);
+	pthread_join(writerThread, NULL);
+
+	PF_PoolLock lock;
+	isWriterRunning = false;
+	isWriterStopping = false;
+
+	// back to write-through for the files that are not deferred otherwise
+	RC result = 0;
+	std::map<PF_FileKey, PF_File*>::iterator itr;
+	for (itr = openedFiles.begin(); itr != openedFiles.end(); ++itr)
+	{
+		if (!IsWriteDeferred(itr->second) && FlushFileData(itr->second) != 0)
+			result = -1;
+	}
+
+	return result;
+}
+
+void WriteDirtyHeaders()
+{
+	// headers of unlogged files whose pages are all written (pages first, as in
+	// FlushFileData()); logged ones wait for a checkpoint, which flushes the log
+	std::map<PF_FileKey, PF_File*>::iterator itr;
+	for (itr = openedFiles.begin(); itr != openedFiles.end(); ++itr)
+	{
+		PF_File* file = itr->second;
+		if (file->isHeaderDirty && !file->isLogged
+			&& file->numDirtyPages == 0 && file->numWritesInProgress == 0
+			&& WriteHeaderToFile(file))
+			file->isHeaderDirty = false;
+	}
+}
+
+RC TakeCheckpoint()
+{
+	// fuzzy checkpoint: the changes go on meanwhile
+	while (isCheckpointing)
+		pthread_cond_wait(&writesDone, &poolMutex);
+	PF_Log* log = writeAheadLog;
+	if (log == NULL)
+		return -1;
+	isCheckpointing = true;
+
+	// write out the headers of the logged files after their log records; the
+	// log has the pages they count that are not written yet. The background
+	// writer leaves compressed pages to the foreground; write them out and
+	// sync them here, as their page map is written after the sync
+	RC result = log->FlushAll() ? 0 : -1;
+	std::vector<PF_File*> files;
+	std::map<PF_FileKey, PF_File*>::iterator itr;
+	for (itr = openedFiles.begin(); itr != openedFiles.end(); ++itr)
+	{
+		PF_File* file = itr->second;
+		if (!file->isLogged)
+			continue;
+
+		if (result == 0 && file->isCompressed && (!bufferPool->FlushFile(file) || SyncPageFile(file) != 0))
+			result = -1;
+		if (result == 0 && file->isHeaderDirty)
+		{
+			if (WriteHeaderToFile(file))
+				file->isHeaderDirty = false;
+			else
+				result = -1;
+		}
+
+		// kept open until the checkpoint is done
+		++file->refCount;
+		files.push_back(file);
+	}
+
+	// recovery starts at the oldest change that is not written yet
+	unsigned long long redoLSN = std::min(log->GetEndLSN(), bufferPool->GetMinRecLSN());
+	for (unsigned i = 0; i < files.size(); ++i)
+	{
+		if (files[i]->isHeaderDirty)
+			redoLSN = std::min(redoLSN, files[i]->headerRecLSN);
+	}
+
+	// the checkpoint record names the logged files, as their naming records may be dropped
+	std::vector<char> data(sizeof(redoLSN));
+	memcpy(&data[0], &redoLSN, sizeof(redoLSN));
+	for (unsigned i = 0; i < files.size(); ++i)
+	{
+		unsigned nameLength = files[i]->name.size();
+		size_t pos = data.size();
+		data.resize(pos + 2 * sizeof(unsigned) + nameLength);
+		memcpy(&data[pos], &files[i]->logFileId, sizeof(unsigned));
+		memcpy(&data[pos + sizeof(unsigned)], &nameLength, sizeof(unsigned));
+		memcpy(&data[pos + 2 * sizeof(unsigned)], files[i]->name.data(), nameLength);
+	}
+	unsigned long long lsn = log->Append(LOG_CHECKPOINT, 0, 0, 0, 0, &data[0], data.size());
+
+	// the records of the operations in progress are kept for undo
+	unsigned long long truncateLSN = redoLSN;
+	std::map<unsigned long long, unsigned long long>::iterator operationItr;
+	for (operationItr = activeOperations.begin(); operationItr != activeOperations.end(); ++operationItr)
+		truncateLSN = std::min(truncateLSN, operationItr->second);
+
+	// the written changes must be durable before the log drops their records
+	pthread_mutex_unlock(&poolMutex);
+	if (!log->Flush(lsn))
+		result = -1;
+	for (unsigned i = 0; i < files.size(); ++i)
+	{
+		if (fdatasync(files[i]->fd) != 0)
+			result = -1;
+	}
+	if (result == 0 && !log->Truncate(truncateLSN))
+		result = -1;
+	pthread_mutex_lock(&poolMutex);
+
+	for (unsigned i = 0; i < files.size(); ++i)
+	{
+		if (ClosePageFile(files[i]) != 0)
+			result = -1;
+	}
+
+	lastCheckpointTime = time(NULL);
+	isCheckpointing = false;
+	pthread_cond_broadcast(&writesDone);
+
+	return result;
+}
+
+unsigned long long BeginOperation()
+{
+	// the changes a thread makes up to its next Commit() form one operation,
+	// undone at recovery if it did not commit. Undo restores the old bytes,
+	// so the operations in progress must not change the same bytes of a page
+	if (activeOperations.count(threadOperationId) == 0)
+	{
+		threadOperationId = ++lastOperationId;
+		activeOperations[threadOperationId] = writeAheadLog->GetEndLSN();
+	}
+
+	return threadOperationId;
+}
+
+unsigned long long AppendCommitRecord(PF_Log* log)
+{
+	// the changes of the other threads belong to their own operations
+	unsigned long long lsn;
+	if (activeOperations.erase(threadOperationId) > 0)
+		lsn = log->Append(LOG_COMMIT, threadOperationId, 0, 0, 0, NULL, 0);
+	else
+		lsn = log->GetEndLSN();		// no changes since the last commit
+	threadOperationId = 0;
+
+	return lsn;
+}
+
+void LogPageChange(PF_File* file, PageNum pageNum, const char* oldData, const char* newData)
+{
+	// log the range of bytes that changed
+	unsigned first = 0;
+	while (first < file->pageSize && oldData[first] == newData[first])
+		++first;
+	if (first == file->pageSize)
+		return;		// page is unchanged
+
+	unsigned last = file->pageSize;
+	while (oldData[last - 1] == newData[last - 1])
+		--last;
+
+	// old bytes for undo, new bytes for redo
+	unsigned length = last - first;
+	std::vector<char> change(2 * length);
+	memcpy(&change[0], oldData + first, length);
+	memcpy(&change[length], newData + first, length);
+	writeAheadLog->Append(LOG_PAGE_DELTA, BeginOperation(), file->logFileId, pageNum, first, &change[0], change.size());
+}
+
+void LogHeaderChange(PF_File* file)
+{
+	PF_Header headers[2] = { file->loggedHeader, file->header };
+	writeAheadLog->Append(LOG_HEADER, BeginOperation(), file->logFileId, 0, 0, headers, sizeof(headers));
+	file->loggedHeader = file->header;
+}
+
+unsigned ComputeChecksum(const char* data, size_t size)
+{
+	// FNV-1a
+	unsigned hash = 2166136261U;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+size_t GetValidLogSize(const std::vector<char>& data, unsigned long long baseLSN)
+{
+	size_t pos = 0;
+	while (data.size() - pos >= sizeof(PF_LogRecord))
+	{
+		PF_LogRecord record;
+		memcpy(&record, &data[pos], sizeof(record));
+		if (record.size < sizeof(record)
+			|| record.size > data.size() - pos
+			|| record.size != sizeof(record) + record.length
+			|| record.lsn != baseLSN + pos)
+			break;
+
+		std::vector<char> recordData(data.begin() + pos, data.begin() + pos + record.size);
+		memset(&recordData[offsetof(PF_LogRecord, checksum)], 0, sizeof(record.checksum));
+		if (ComputeChecksum(&recordData[0], recordData.size()) != record.checksum)
+			break;
+
+		pos += record.size;
+	}
+
+	return pos;
+}
+
+bool RecoverFromLog(PF_Log* log)
+{
+	std::vector<char> records;
+	if (!log->ReadRecords(0, records))
+		return false;
+	if (records.empty())
+		return true;	// clean shutdown
+
+	// analysis: find the committed operations, the redo start of the last
+	// checkpoint, the names of the logged files, and where each file was last
+	// created or destroyed (files are created and removed right away,
+	// committed or not)
+	std::set<unsigned long long> committedOperations;
+	unsigned long long redoLSN = 0;
+	std::map<unsigned, std::string> fileNames;
+	std::map<std::string, size_t> lastFileChanges;
+	std::set<std::string> destroyedFiles;
+	PF_LogRecord record;
+	for (size_t pos = 0; pos < records.size(); pos += record.size)
+	{
+		memcpy(&record, &records[pos], sizeof(record));
+		const char* data = &records[pos + sizeof(record)];
+		if (record.type == LOG_COMMIT)
+			committedOperations.insert(record.operation_id);
+		else if (record.type == LOG_FILE)
+			fileNames[record.file_id] = std::string(data, record.length);
+		else if (record.type == LOG_CHECKPOINT)
+		{
+			// the changes before the redo start are in the files
+			if (record.length >= sizeof(redoLSN))
+				memcpy(&redoLSN, data, sizeof(redoLSN));
+
+			// the naming records of the files opened before may have been dropped
+			for (unsigned i = sizeof(unsigned long long); i + 2 * sizeof(unsigned) <= record.length; )
+			{
+				unsigned fileId, nameLength;
+				memcpy(&fileId, data + i, sizeof(fileId));
+				memcpy(&nameLength, data + i + sizeof(fileId), sizeof(nameLength));
+				i += 2 * sizeof(unsigned);
+				if (nameLength > record.length - i)
+					break;
+				fileNames[fileId] = std::string(data + i, nameLength);
+				i += nameLength;
+			}
+		}
+		else if (record.type == LOG_CREATE || record.type == LOG_DESTROY)
+		{
+			std::string fileName(data, record.length);
+			lastFileChanges[fileName] = pos;
+			if (record.type == LOG_DESTROY)
+				destroyedFiles.insert(fileName);
+			else
+				destroyedFiles.erase(fileName);
+		}
+	}
+
+	// redo: repeat history from the redo start, the incomplete operations
+	// included, so that their changes can be undone from a known state
+	bool result = true;
+	std::map<std::string, PF_File*> files;
+	std::vector<std::pair<size_t, PF_File*> > undoRecords;
+	for (size_t pos = 0; pos < records.size(); pos += record.size)
+	{
+		memcpy(&record, &records[pos], sizeof(record));
+		const char* data = &records[pos + sizeof(record)];
+		if (record.type != LOG_PAGE_DELTA && record.type != LOG_PAGE_IMAGE && record.type != LOG_HEADER)
+			continue;
+
+		std::map<unsigned, std::string>::iterator nameItr = fileNames.find(record.file_id);
+		if (nameItr == fileNames.end())
+			continue;
+		const std::string& fileName = nameItr->second;
+
+		// changes to an earlier file of the same name are obsolete
+		std::map<std::string, size_t>::iterator changeItr = lastFileChanges.find(fileName);
+		if (changeItr != lastFileChanges.end()
+			&& (pos < changeItr->second || destroyedFiles.count(fileName) > 0))
+			continue;
+
+		std::map<std::string, PF_File*>::iterator fileItr = files.find(fileName);
+		if (fileItr == files.end())
+			fileItr = files.insert(std::make_pair(fileName, OpenPageFile(fileName.c_str(), false))).first;
+		if (fileItr->second == NULL)
+			continue;	// removed without a logged destruction
+
+		// except for the whole pages of an incomplete operation: appended pages
+		// go away with the page count, and WritePages() writes none before the
+		// operation commits
+		bool isCommitted = committedOperations.count(record.operation_id) > 0;
+		if (record.type == LOG_PAGE_IMAGE && !isCommitted)
+			continue;
+
+		if (record.lsn >= redoLSN && ApplyLogRecord(fileItr->second, record, data, false) != 0)
+			result = false;
+		if (!isCommitted)
+			undoRecords.push_back(std::make_pair(pos, fileItr->second));
+	}
+
+	// undo: roll back the incomplete operations, last change first. Records
+	// hold whole byte ranges, so redo and undo can simply run again if the
+	// system goes down before the log is emptied
+	for (size_t i = undoRecords.size(); i-- > 0; )
+	{
+		size_t pos = undoRecords[i].first;
+		memcpy(&record, &records[pos], sizeof(record));
+		if (ApplyLogRecord(undoRecords[i].second, record, &records[pos + sizeof(record)], true) != 0)
+			result = false;
+	}
+
+	// make the recovered files durable before the log is emptied
+	std::map<std::string, PF_File*>::iterator itr;
+	for (itr = files.begin(); itr != files.end(); ++itr)
+	{
+		PF_File* file = itr->second;
+		if (file == NULL)
+			continue;
+
+		if (FlushFileData(file) != 0 || SyncPageFile(file) != 0)
+			result = false;
+		if (ClosePageFile(file) != 0)
+			result = false;
+	}
+
+	return result;
+}
+
+RC ApplyLogRecord(PF_File* file, const PF_LogRecord& record, const char* data, bool isUndo)
+{
+	// header and page delta records hold the old values, then the new ones
+	PF_Header& header = file->header;
+	if (record.type == LOG_HEADER)
+	{
+		if (record.length != 2 * sizeof(PF_Header))
+			return -1;
+
+		PF_Header loggedHeader;
+		memcpy(&loggedHeader, data + (isUndo ? 0 : sizeof(loggedHeader)), sizeof(loggedHeader));
+		header.num_pages = loggedHeader.num_pages;
+		header.num_free_pages = loggedHeader.num_free_pages;
+		header.free_list_head = loggedHeader.free_list_head;
+		file->isFreePageSetLoaded = false;
+		file->SetHeaderDirty();
+		if (file->isLogged)
+			LogHeaderChange(file);	// an operation rolled back by Abort()
+		return AllocateExtent(file, static_cast<PageNum>(header.num_pages));
+	}
+
+	PageNum pageNum = static_cast<PageNum>(record.page_num);
+	if (isUndo)
+	{
+		// appended pages go away with the page count, and whole pages written
+		// over others commit with them; nothing to restore
+		if (record.type == LOG_PAGE_IMAGE || pageNum >= header.num_pages)
+			return 0;
+	}
+	else if (pageNum >= header.num_pages)
+	{
+		// pages appended after the header was last written
+		if (AllocateExtent(file, pageNum + 1) != 0)
+			return -1;
+		header.num_pages = pageNum + 1;
+		file->SetHeaderDirty();
+	}
+
+	if (record.type == LOG_PAGE_IMAGE)
+	{
+		if (record.length != file->pageSize)
+			return -1;
+		return WritePageThroughPool(file, pageNum, data, NULL, false);
+	}
+
+	// page delta
+	unsigned length = record.length / 2;
+	if (record.length % 2 != 0 || record.offset + length > file->pageSize)
+		return -1;
+
+	std::vector<char> pageData(file->pageSize);
+	if (ReadPageThroughPool(file, pageNum, &pageData[0], NULL, false) != 0)
+		return -1;
+	memcpy(&pageData[record.offset], data + (isUndo ? 0 : length), length);
+
+	return WritePageThroughPool(file, pageNum, &pageData[0], NULL, false);
+}
+
+unsigned long long GetMicroseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return static_cast<unsigned long long>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+void RecordLatency(PF_File* file, PF_LatencyStats PF_IOStats::*operation, unsigned long long startTime)
+{
+	// bucket i holds latencies in [2^(i-1), 2^i) microseconds
+	unsigned long long micros = GetMicroseconds() - startTime;
+	unsigned bucket = 0;
+	while (bucket + 1 < PF_LATENCY_BUCKETS && (micros >> bucket) != 0)
+		++bucket;
+
+	PF_LatencyStats* latencies[2] = { &(globalStats.*operation), &(file->stats->*operation) };
+	for (unsigned i = 0; i < 2; ++i)
+	{
+		PF_LatencyStats& stats = *latencies[i];
+		++stats.count;
+		stats.totalMicros += micros;
+		stats.maxMicros = std::max(stats.maxMicros, micros);
+		++stats.buckets[bucket];
+	}
+}
+
+void CountPageIO(PF_File* file, bool isWrite, unsigned long long numPages)
+{
+	// pages transferred to or from the file, whatever the request
+	if (isWrite)
+	{
+		globalStats.pagesWritten += numPages;
+		file->stats->pagesWritten += numPages;
+	}
+	else
+	{
+		globalStats.pagesRead += numPages;
+		file->stats->pagesRead += numPages;
+	}
+}
+
+bool IsFileStatsInUse(const PF_IOStats* stats)
+{
+	// an opened file points to the counters of the name it was opened with
+	std::map<PF_FileKey, PF_File*>::const_iterator itr;
+	for (itr = openedFiles.begin(); itr != openedFiles.end(); ++itr)
+	{
+		if (itr->second->stats == stats)
+			return true;
+	}
+
+	return false;
+}
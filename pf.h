@@ -0,0 +1,123 @@
+#ifndef _pf_h_
+#define _pf_h_
+
+typedef int RC;
+typedef unsigned PageNum;
+
+const unsigned PF_PAGE_SIZE = 4096;		// default page size; files may use 8K, 16K, 32K or 64K pages too
+
+const unsigned PF_LATENCY_BUCKETS = 32;	// bucket i: [2^(i-1), 2^i) microseconds
+
+// latencies of one kind of call
+struct PF_LatencyStats
+{
+	unsigned long long count;
+	unsigned long long totalMicros;
+	unsigned long long maxMicros;
+	unsigned long long buckets[PF_LATENCY_BUCKETS];
+};
+
+// I/O counters, globally or for one file
+struct PF_IOStats
+{
+	PF_LatencyStats readPage;
+	PF_LatencyStats writePage;
+	PF_LatencyStats appendPage;
+	PF_LatencyStats flush;				// write-backs of deferred pages and headers
+	unsigned long long cacheHits;		// buffer pool
+	unsigned long long cacheMisses;
+	unsigned long long pagesRead;		// from the file, whatever the request
+	unsigned long long pagesWritten;
+	unsigned long long headerWrites;
+	unsigned long long syncs;
+};
+
+class PF_FileHandle;
+struct PF_FileHandle_Data;
+
+class PF_Manager
+{
+public:
+    static PF_Manager* Instance();                                      // Access to the _pf_manager instance
+
+    RC CreateFile    (const char *fileName);                            // Create a new file
+    RC CreateFile    (const char *fileName, unsigned pageSize);         // Create a new file with pages of pageSize bytes
+    RC CreateFile    (const char *fileName, unsigned pageSize, bool isCompressed);	// Create a new file, compressed or not
+    RC DestroyFile   (const char *fileName);                            // Destroy a file
+    RC OpenFile      (const char *fileName, PF_FileHandle &fileHandle); // Open a file
+    RC OpenFile      (const char *fileName, PF_FileHandle &fileHandle, bool isDirectIO);	// Open a file, bypassing the kernel page cache
+    RC CloseFile     (PF_FileHandle &fileHandle);                       // Close a file
+
+    RC SetBufferPoolSize(unsigned numPages);                            // Resize the buffer pool (no page may be pinned)
+    unsigned GetBufferPoolSize() const;                                 // Get the number of buffer pool frames
+    RC SetWriteBackMode(bool isEnabled, unsigned maxPages = 128, unsigned maxSeconds = 5);	// Defer page writes
+
+    RC OpenLog       (const char *logFileName);                         // Open the write-ahead log, recovering the logged files
+    RC CloseLog      ();                                                // Sync the logged files and close the log
+    RC Commit        ();                                                // Make the changes of the calling thread's operation durable
+    RC Abort         ();                                                // Undo the changes of the calling thread's operation
+    RC SetBackgroundWriter(bool isEnabled, unsigned maxPages = 64, unsigned checkpointSeconds = 30);	// Write back in a thread
+    RC Checkpoint    ();                                                // Take a checkpoint now
+
+    RC GetIOStats    (PF_IOStats &stats);                               // Get the global I/O counters
+    RC GetIOStats    (const char *fileName, PF_IOStats &stats);         // Get the I/O counters of a file
+    RC ResetIOStats  ();                                                // Clear all I/O counters
+
+protected:
+    PF_Manager();                                                       // Constructor
+    ~PF_Manager   ();                                                   // Destructor
+
+private:
+    static PF_Manager *_pf_manager;
+};
+
+
+class PF_FileHandle
+{
+public:
+    PF_FileHandle();                                                    // Default constructor
+    ~PF_FileHandle();                                                   // Destructor
+
+    RC ReadPage(PageNum pageNum, void *data);                           // Get a specific page
+    RC WritePage(PageNum pageNum, const void *data);                    // Write a specific page
+    RC AppendPage(const void *data);                                    // Append a specific page
+    RC AppendPage(const void *data, PageNum &pageNum);                  // Append a page, reusing a free one if any
+    RC AppendPages(unsigned count, const void *data);                   // Append count contiguous pages
+
+    RC ReadPages(PageNum startPage, unsigned count, void *data);        // Get a range of pages
+    RC ReadPages(const PageNum *pageNums, unsigned count, void *const *data);	// Get a list of pages
+    RC WritePages(PageNum startPage, unsigned count, const void *data); // Write a range of pages, as below
+    RC WritePages(const PageNum *pageNums, unsigned count, const void *const *data);	// Write a list of pages; commits the operation of logged files
+
+    RC DeallocatePage(PageNum pageNum);                                 // Put a page on the free page list
+    bool IsPageFree(PageNum pageNum);                                   // Check whether a page is deallocated
+    unsigned GetNumberOfFreePages();                                    // Get the number of deallocated pages
+
+    RC PinPage(PageNum pageNum, void *&data);                           // Keep a page in the buffer pool and access it there
+    RC UnpinPage(PageNum pageNum, bool isDirty);                        // Release a pinned page
+
+    RC ReadPagesAsync(const PageNum *pageNums, unsigned count, void *const *data);	// Queue page reads
+    RC WritePagesAsync(const PageNum *pageNums, unsigned count, const void *const *data);	// Queue page writes
+    RC WaitForIO();                                                     // Complete the queued requests
+    unsigned GetNumPendingIO();                                         // Get the number of queued requests
+
+    RC Prefetch(PageNum startPage, unsigned count);                     // Hint that a range of pages is read next
+    void SetReadAhead(bool isEnabled);                                  // Read ahead of sequential reads (default)
+    void SetAccessRing(unsigned numPages);                              // Recycle the frames of this handle's misses (0: off)
+
+    RC EnableLogging();                                                 // Log the changes made through the file
+    RC Sync();                                                          // Write back the file and sync it
+
+    unsigned GetNumberOfPages();                                        // Get the number of pages in the file
+    unsigned GetPageSize();                                             // Get the page size of the file
+
+private:
+    PF_FileHandle(const PF_FileHandle&);
+    PF_FileHandle& operator=(const PF_FileHandle&);
+
+    PF_FileHandle_Data* _pimpl;
+
+    friend class PF_Manager;
+};
+
+ #endif
@@ -7,6 +7,8 @@ enum ERROR_CODE{ NOT_ENOUGH_MEMORY = 1,
 				 DUPLICATE_KEY_OR_NOT_ENOUGH_MEMORY,
 				 UNKNOWN_ERROR};
 
+static const unsigned PARTITION_RING_PAGES = 32;	// buffer pool frames recycled by partition reads
+
 
 ///////////////////////////////////////////////
 // Project Function Definitions
@@ -750,6 +752,7 @@ RC HashJoin::getNextTuple(void* data)
 				PF_FileHandle sFileHandle;
 				if (_pf->OpenFile(sFilename.c_str(), sFileHandle) != 0)
 					assert(false);
+				sFileHandle.SetAccessRing(PARTITION_RING_PAGES);
 
 				unsigned numPages = sFileHandle.GetNumberOfPages();
 
@@ -827,6 +830,7 @@ RC HashJoin::getNextTuple(void* data)
 
 			if (_pf->OpenFile(rFilename.c_str(), _rFileHandle) == 0)
 			{
+				_rFileHandle.SetAccessRing(PARTITION_RING_PAGES);
 				_rIter = PartitionIterator(_rFileHandle, _buffer, PF_PAGE_SIZE,
 										   _RAttributes, _RAttrIndex);
 
@@ -8,19 +8,214 @@
 #include "TupleUtility.h"
 
 #include <math.h>
+#include <algorithm>
 #include <stdlib.h>
 #include <string>
+#include <set>
 #include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
 
 ///////////////////////////////////////////
 // Constants
 ///////////////////////////////////////////
 
+static const unsigned INSERT_BATCH_PAGES = 64;	// new pages appended together by insertTuples
+static const char LOG_FILE_NAME[] = "CS222_Log";	// write-ahead log of the table files
+static const unsigned SCAN_RING_PAGES = 32;		// buffer pool frames recycled by a scan (128 KB)
+static const TableId INVALID_TABLE_ID = static_cast<TableId>(-1);
+static const unsigned MIN_CATALOG_INDEX_SLOTS = 64;	// power of two
+
+static const char CATALOG_SNAPSHOT_FILE_NAME[] = "CS222_Catalog_Snapshot";	// the cached catalog, loaded at startup
+static const char CATALOG_SNAPSHOT_TAG[] = "RM_CATALOG";
+static const unsigned CATALOG_SNAPSHOT_VERSION = 1;
+
+static const char FREE_SPACE_MAP_SUFFIX[] = ".fsm";	// the free space map of a table file, next to it
+static const unsigned FREE_SPACE_CLASSES = 256;		// one byte per page in the map
+static const unsigned FREE_SPACE_BATCH_PAGES = 64;	// pages read together while building the map
+
+static const unsigned FREE_SLOT_LIST_TAG = 0x5F5E0000;		// in nextPage, with the first free slot
+static const unsigned FREE_SLOT_LIST_MASK = 0x0000FFFF;
+static const unsigned FREE_SLOT_LIST_END = FREE_SLOT_LIST_MASK;
+
+static const unsigned REORGANIZE_BATCH_PAGES = 64;	// pages collapsed per commit, or packed per write, by reorganizeTable()
+
+static const unsigned TUPLE_SCHEMA_VERSION_SIZE = sizeof(unsigned);	// in front of every stored tuple
+static const unsigned TABLE_FORMAT_VERSION = 1;		// in the directory page; 1: tuples start with their schema version
+
+///////////////////////////////////////////
+// Class Definitions
+///////////////////////////////////////////
+
+// free space of the pages of a table, kept as a size class per page: the free
+// bytes rounded down to a multiple of 1/FREE_SPACE_CLASSES of the table's page
+// size. The pages of each
+// class are in a bucket, and a bitmap tells the buckets that aren't empty, so a
+// page with room for a tuple is found in constant time however large the table.
+// The classes are stored one byte per page in a logged file of their own, which
+// grows by a page for every PF_PAGE_SIZE table pages.
+class FreeSpaceMap
+{
+public:
+	FreeSpaceMap();
+
+	RC Open(PF_Manager* pf, const string& tableFileName, PF_FileHandle& tableHandle);
+	RC Close(PF_Manager* pf);
+
+	bool ObtainFreePage(unsigned requiredSize, PageNum& pageNum) const;
+	void RemovePage(PageNum pageNum);
+	bool InsertFreePage(PageNum pageNum, unsigned freeSize);
+	void ResetData();
+	RC FlushDataToFile();
+
+	bool HasSufficientSpace(unsigned freeSize) const;
+
+private:
+	RC LoadData(PF_FileHandle& tableHandle);
+	void SetClass(PageNum pageNum, unsigned sizeClass);
+	void AddToBucket(PageNum pageNum, unsigned sizeClass);
+	void RemoveFromBucket(PageNum pageNum);
+
+	PF_FileHandle _fileHandle;
+	unsigned _classBytes;				// free bytes each class stands for
+	vector<unsigned char> _classes;		// by page number; 0 when the page has no room
+	vector<unsigned> _positions;		// of each page in the bucket of its class
+	vector<PageNum> _buckets[FREE_SPACE_CLASSES];
+	unsigned long long _nonEmptyBuckets[FREE_SPACE_CLASSES / 64];
+	set<PageNum> _dirtyMapPages;		// to write by FlushDataToFile()
+};
+
+// orders RIDs by page, then slot, for maps keyed by them
+struct RIDLess
+{
+	bool operator()(const RID& lhs, const RID& rhs) const
+	{
+		return lhs.pageNum < rhs.pageNum || (lhs.pageNum == rhs.pageNum && lhs.slotNum < rhs.slotNum);
+	}
+};
+
+// progress of a table reorganization: the forwarding chains are collapsed a
+// batch of pages at a time, then the tuples are packed into the first pages
+// in a single call
+struct TableReorganization
+{
+	TableReorganization() : isPacking(false), nextPage(1), outputPage(1) {}
+
+	bool isPacking;			// only within the call doing the packing
+	PageNum nextPage;		// to collapse the chains of, or to pack the tuples of
+	PageNum outputPage;		// packed into; the pages after it up to nextPage are empty
+	map<RID, RID, RIDLess> forwardedFrom;	// tuple -> tombstone forwarding to it
+};
+
+// a table file kept open (along with its free space map) between tuple operations
+struct OpenedTable
+{
+	PF_FileHandle fileHandle;
+	FreeSpaceMap* freeSpaceMap;
+	TableReorganization* reorganization;	// NULL unless a reorganization is under way
+};
+
+// pages read and changed by a batch of a reorganization, written back at its end
+struct PageBatch
+{
+	map<PageNum, char*> pages;		// malloc'ed, since RearrangePage() may reallocate them
+	set<PageNum> dirtyPages;
+};
+
+// a tuple read off its page by a reorganization, to be packed into another
+struct PendingTuple
+{
+	RID rid;			// where it was read from
+	unsigned offset;	// of its data in PendingTuples::data
+	unsigned size;
+	bool isForwarded;	// by the tombstone at home
+	RID home;
+};
+
+struct PendingTuples
+{
+	vector<PendingTuple> tuples;
+	vector<char> data;
+	map<RID, size_t, RIDLess> index;	// by the RID read from, until packed
+};
+
+// start of the catalog snapshot file; the tables follow it, each as its name,
+// its number of attributes, then the name, type, length and validity of each
+struct CatalogSnapshotHeader
+{
+	char tag[sizeof(CATALOG_SNAPSHOT_TAG)];
+	unsigned version;
+	unsigned size;			// of the data after the header
+	unsigned checksum;		// of the data after the header
+	unsigned numTables;
+};
+
+// a table name interned as a TableId; a table deleted and created again gets
+// its old id back
+struct CatalogTable
+{
+	string tableName;
+	TableInfo* tableInfo;		// in RM::_catalogAttrTable; NULL while the table does not exist
+	OpenedTable* openedTable;	// NULL until the table is first used
+	vector<TableInfo> tupleSchemas;	// by schema version, built as tuples of each version are read
+};
+
 ///////////////////////////////////////////
 // Helper Function Declarations
 ///////////////////////////////////////////
 
+unsigned ComputeHash(const void* data, size_t size);
+unsigned HashTableName(const string& tableName);
+TableId FindTableId(const string& tableName);
+TableId InternTableName(const string& tableName);
+CatalogTable* GetCatalogTable(TableId tableId);
+OpenedTable* GetOpenedTable(PF_Manager* pf, CatalogTable& catalogTable);
+RC OpenTableFile(PF_Manager* pf, CatalogTable& catalogTable);
+void CloseOpenedTable(PF_Manager* pf, const string& tableName);
+void CloseAllOpenedTables(PF_Manager* pf);
+RC CommitOperation(PF_Manager* pf);
+RC AbortOperation(PF_Manager* pf, const string& tableName);
+unsigned AddTupleToPage(PagePointers& ptrs, char*& rec, const char* intRepr, unsigned recSize);
+unsigned GetDeletedSlotPtr(const PagePointers& ptrs);
+void PushFreeSlot(PagePointers& ptrs, unsigned slotNum);
+bool PopFreeSlot(PagePointers& ptrs, unsigned& slotNum);
+void BuildFreeSlotList(PagePointers& ptrs);
+bool IsSameRID(const RID& lhs, const RID& rhs);
+bool GetForwardingRID(const PagePointers& ptrs, const char* rec, unsigned slotNum, RID& target);
+bool TakeForwarding(TableReorganization& reorg, const RID& rid, RID& home);
+bool LoadBatchPage(PF_FileHandle& fh, PageBatch& batch, PageNum pageNum);
+RC WriteBatchPages(PF_FileHandle& fh, FreeSpaceMap& fsm, const TableReorganization& reorg, PageBatch& batch, bool isDone);
+void FreeBatchPages(PageBatch& batch);
+bool RedirectTombstone(PF_FileHandle& fh, PageBatch& batch, const RID& home, const RID& from, const RID& to);
+RC CollapseForwarding(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, unsigned maxPages);
+RC CollapseChain(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, const RID& home, RID target);
+RC PackPages(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, unsigned maxPages, bool& isDone);
+RC ReadPackedPage(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, PendingTuples& pending);
+RC PackTuple(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, PendingTuples& pending, size_t index);
+RC AppendBatchPages(PF_FileHandle& fh, FreeSpaceMap& fsm, vector<char>& pages);
+string GetFreeSpaceMapFilename(const string& tableFileName);
+void IndexCatalog(map<string, TableInfo>& catalog);
+bool LoadCatalogSnapshot(map<string, TableInfo>& catalog);
+bool SaveCatalogSnapshot(const map<string, TableInfo>& catalog);
+void RemoveCatalogSnapshot();
+void AppendSnapshotData(vector<char>& data, const void* value, size_t size);
+void AppendSnapshotString(vector<char>& data, const string& value);
+bool ReadSnapshotData(const vector<char>& data, size_t& pos, void* value, size_t size);
+bool ReadSnapshotString(const vector<char>& data, size_t& pos, string& value);
+bool AttributePositionLess(const pair<unsigned, Attribute>& lhs, const pair<unsigned, Attribute>& rhs);
+bool FindValidAttribute(const TableInfo& tableInfo, const string& attrName, unsigned& attrIndex);
+bool HasDroppedAttributes(const TableInfo& tableInfo);
+RC CheckTableFormat(PF_FileHandle& fileHandle);
+const TableInfo& GetTupleSchema(const TableInfo& tableInfo, vector<TableInfo>& schemas, unsigned version);
+unsigned GetMaxStoredTupleSize(const TableInfo& tableInfo);
+void ExternalToStoredTupleFormat(const TableInfo& tableInfo, vector<TableInfo>& schemas, const void* data, char* stored, unsigned& storedSize);
+void StoredToExternalTupleFormat(const TableInfo& tableInfo, vector<TableInfo>& schemas, const char* stored, void* data, unsigned& dataSize);
+void GetStoredTupleAttribute(const TableInfo& tableInfo, vector<TableInfo>& schemas, const char* stored, unsigned attrIndex, void* data, unsigned& dataSize);
+unsigned GetExternalAttributeSize(const Attribute& attr, const char* data);
+unsigned GetDefaultAttribute(const Attribute& attr, void* data);
+
 ///////////////////////////////////////////
 // Variables
 ///////////////////////////////////////////
@@ -28,6 +223,10 @@
 RM* RM::_rm = 0;
 PF_Manager* RM::pf = 0;
 
+static vector<CatalogTable> catalogTables;		// by TableId
+static vector<TableId> catalogIndex;		// open addressing (linear probing) on the table name hash
+static bool isInNestedOperation = false;	// updateTuple() moving a tuple through insertTuple()
+
 ///////////////////////////////////////////
 // RM Public Class Function Definitions
 ///////////////////////////////////////////
@@ -47,6 +246,14 @@ RM* RM::Instance()
 		if(!_rm->pf)
     		_rm->pf = PF_Manager::Instance();
 
+		// recover the tables from the log; without a log, changes are not logged
+		if (_rm->pf->OpenLog(LOG_FILE_NAME) != 0)
+			cout << "****Warning: Could not open the log " << LOG_FILE_NAME << endl;
+
+		// write changed pages and take checkpoints in the background
+		if (_rm->pf->SetBackgroundWriter(true) != 0)
+			cout << "****Warning: Could not start the background writer" << endl;
+
 		// load attribute catalog
 		if (doesTableExist(PRE_CATALOG_ATTRIBUTES_TABLE_NAME))
 			_rm->loadAttributeCatalog();
@@ -61,9 +268,22 @@ RM::RM()
 
 RM::~RM()
 {
+	CloseAllOpenedTables(pf);
+	pf->SetBackgroundWriter(false);
+	pf->CloseLog();
 }
 
 RC RM::createTable(const string tableName, const vector<Attribute> & attrs)
+{
+	return createTable(tableName, attrs, false);
+}
+
+RC RM::createTable(const string tableName, const vector<Attribute> & attrs, bool isCompressed)
+{
+	return createTable(tableName, attrs, PF_PAGE_SIZE, isCompressed);
+}
+
+RC RM::createTable(const string tableName, const vector<Attribute> & attrs, const unsigned pageSize, bool isCompressed)
 {
 	if (tableName != CATALOG_ATTRIBUTES_TABLE_NAME)
 	{
@@ -78,9 +298,12 @@ RC RM::createTable(const string tableName, const vector<Attribute> & attrs)
 		}
 	}
 
-	// create table file
+	// a free space map left by an earlier table of the same name is out of date
 	string tableFilename = getTableFilename(tableName);
-	if (pf->CreateFile(tableFilename.c_str()) != 0)
+	pf->DestroyFile(GetFreeSpaceMapFilename(tableFilename).c_str());
+
+	// create table file; compressed tables store their pages compressed, beneath the slotted page format
+	if (pf->CreateFile(tableFilename.c_str(), pageSize, isCompressed) != 0)
 		return -1;
 
 	// open table file
@@ -88,12 +311,14 @@ RC RM::createTable(const string tableName, const vector<Attribute> & attrs)
 	if (pf->OpenFile(tableFilename.c_str(), fileHandle) != 0)
 		return -1;
 
-	// append directory of pages
-	char directoryData[PF_PAGE_SIZE];
-	fileHandle.AppendPage(directoryData);
+	// append directory of pages; it keeps page 0, the free space of the data
+	// pages is tracked by the table's free space map
+	vector<char> directoryData(pageSize);
+	fileHandle.AppendPage(&directoryData[0]);
 	PageDirectory pDir(fileHandle);
 	{
 		pDir.ResetData();
+		pDir.SetFormatVersion(TABLE_FORMAT_VERSION);
 		pDir.FlushDataToFile();
 		assert(fileHandle.GetNumberOfPages() == 1);
 	}
@@ -111,7 +336,11 @@ RC RM::createTable(const string tableName, const vector<Attribute> & attrs)
 	//assert(_catalogAttrTable.find(tableName) == _catalogAttrTable.end());	// make sure key doesn't already exists
 	unsigned maxTupleSize = ComputeMaxInternalTupleSize(attrs);		// compute max internal tuple size (to be stored in cached attribute catalog
 	TableInfo tInfo = {attrs, attrsValid, maxTupleSize};
-	_catalogAttrTable.insert(pair<string, TableInfo >(tableName, tInfo));
+	RemoveCatalogSnapshot();	// out of date until the catalog file has the table
+	map<string, TableInfo>::iterator catalogItr = _catalogAttrTable.insert(pair<string, TableInfo >(tableName, tInfo)).first;
+	CatalogTable& catalogTable = catalogTables[InternTableName(tableName)];
+	catalogTable.tableInfo = &catalogItr->second;
+	catalogTable.tupleSchemas.clear();
 
 	// insert table attributes into catalog file
 	RID rid;
@@ -124,6 +353,7 @@ RC RM::createTable(const string tableName, const vector<Attribute> & attrs)
 		this->insertTuple(CATALOG_ATTRIBUTES_TABLE_NAME, packedTuple.GetData(), rid);
 	}
 
+	SaveCatalogSnapshot(_catalogAttrTable);
 	return 0;
 }
 
@@ -138,37 +368,46 @@ RC RM::deleteTable(const string tableName)
 		return -1;
 
 	// remove from catalog cache
+	RemoveCatalogSnapshot();	// out of date until the catalog file no longer has the table
+	CloseOpenedTable(pf, tableName);
+	pf->DestroyFile(GetFreeSpaceMapFilename(getTableFilename(tableName)).c_str());
+	TableId tableId = FindTableId(tableName);
+	if (tableId != INVALID_TABLE_ID)
+	{
+		catalogTables[tableId].tableInfo = NULL;
+		catalogTables[tableId].tupleSchemas.clear();
+	}
 	int amtRemoved = _catalogAttrTable.erase(tableName);
 	assert(amtRemoved == 1);
 
-	// remove from catalog file
-	string tableFileName = getTableFilename(CATALOG_ATTRIBUTES_TABLE_NAME);
-	PF_FileHandle fh;
-	if (pf->OpenFile(tableFileName.c_str(), fh) == 0)
-	{
-		// delete all tuples where the tablename attribute value == tablename
-		RM_ScanIterator itr;
-		vector<string> projectedAttributeNames;
-		if (scan(tableName, 
-				CATALOG_TABLE_NAME_STRING, 
-				EQ_OP, 
-				tableName.c_str(),
-				projectedAttributeNames, 
-				itr))
-		{
-			RID rid;
+	// remove from catalog file: find all tuples where the tablename attribute value == tablename, then delete them
+	RM_ScanIterator itr;
+	vector<string> projectedAttributeNames;
+	TupleItem tableNameValue(tableName);	// the scan keeps a pointer to it
+	if (scan(CATALOG_ATTRIBUTES_TABLE_NAME, 
+			CATALOG_TABLE_NAME_STRING, 
+			EQ_OP, 
+			tableNameValue.GetData(),
+			projectedAttributeNames, 
+			itr) != 0)
+		return -1;
 
-			while (itr.getNextTuple(rid, NULL) != RM_EOF)
-			{
-				deleteTuple(CATALOG_ATTRIBUTES_TABLE_NAME, rid);
-			}
-		}
+	vector<RID> catalogRids;
+	RID rid;
+	while (itr.getNextTuple(rid, NULL) != RM_EOF)
+		catalogRids.push_back(rid);
+	itr.close();
+
+	for (unsigned i = 0; i < catalogRids.size(); ++i)
+	{
+		if (deleteTuple(CATALOG_ATTRIBUTES_TABLE_NAME, catalogRids[i]) != 0)
+			return -1;
 	}
-	else
-		return -1;
 
-	// destroy table file
-	pf->DestroyFile(tableFileName.c_str());
+	// destroy table file; only then does the snapshot match the catalog file again
+	if (pf->DestroyFile(getTableFilename(tableName).c_str()) != 0)
+		return -1;
+	SaveCatalogSnapshot(_catalogAttrTable);
 	return 0;
 }
 
@@ -179,173 +418,285 @@ RC RM::getAttributes(const string tableName, vector<Attribute> & attrs)
 
 	if (itr != _catalogAttrTable.end())
 	{
-		attrs = itr->second.attribute;
+		// dropped attributes keep their place in the table info, but aren't part of the tuples
+		attrs.clear();
+		const TableInfo& tinf = itr->second;
+		for (unsigned i = 0; i < tinf.attribute.size(); ++i)
+		{
+			if (tinf.attrValidity[i])
+				attrs.push_back(tinf.attribute[i]);
+		}
 		return 0;
 	}
 
 	return -1;
 }
 
+RC RM::openTable(const string tableName, TableId & tableId)
+{
+	tableId = FindTableId(tableName);
+	CatalogTable* catalogTable = GetCatalogTable(tableId);
+	if (catalogTable == NULL)
+		return -1;
+
+	// open the table file now, to report one of an older format
+	if (catalogTable->openedTable == NULL)
+		return OpenTableFile(pf, *catalogTable);
+
+	return 0;
+}
+
 RC RM::insertTuple(const string tableName, const void *data, RID & rid)
 {
-	if (!tableExists(tableName))
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
+
+	return insertTuple(tableId, data, rid);
+}
+
+RC RM::insertTuple(const TableId tableId, const void *data, RID & rid)
+{
+	CatalogTable* catalogTable = GetCatalogTable(tableId);
+	if (catalogTable == NULL)
 		return -1;
 
 	PageNum free_page;
 	PagePointers ptrs;
-	PF_FileHandle fh;
 	unsigned recSize = 0;
-	unsigned newSlotPos;
-	bool reused = false;
 
-	char* rec = (char*)malloc(PF_PAGE_SIZE);
-	TableInfo tinf = _catalogAttrTable[tableName];
-	char* intRepr = (char*) malloc(GetMaxInternalTupleSize(tinf));
-	ExternalToInternalTupleFormat(tinf, data, intRepr, recSize);
+	char* rec = NULL;
+	TableInfo& tinf = *catalogTable->tableInfo;
+	char* intRepr = (char*) malloc(GetMaxStoredTupleSize(tinf));
+	ExternalToStoredTupleFormat(tinf, catalogTable->tupleSchemas, data, intRepr, recSize);
 
 	//////////////////////////////////////////////////////////
-	// Initialization: Opens file, retrieves directory page, creates PageDirectory object, requests for free space page
+	// Initialization: Retrieves the opened table file and its free space map, requests for free space page
 	//////////////////////////////////////////////////////////
-	string tableFileName = getTableFilename(tableName);
-	if (pf->OpenFile(tableFileName.c_str(), fh) == 0)
+	OpenedTable* table = GetOpenedTable(pf, *catalogTable);
+	if (table != NULL)
 	{
-		PageDirectory pd(fh);
+		PF_FileHandle& fh = table->fileHandle;
+		FreeSpaceMap& fsm = *table->freeSpaceMap;
+		rec = (char*)malloc(fh.GetPageSize());
 
-		// query directory for an existing page with sufficient free space
+		// query the free space map for an existing page with sufficient free space
 		unsigned requiredSize = recSize + sizeof(SlotStore);
-		if (pd.ObtainFreePage(requiredSize, free_page))
+		RC result = 0;
+		if (fsm.ObtainFreePage(requiredSize, free_page))
 		{
-			fh.ReadPage(free_page, rec);
-			RetrievePagePointers(ptrs, rec);
+			result = fh.ReadPage(free_page, rec);
+			RetrievePagePointers(ptrs, rec, fh.GetPageSize());
 
-			assert(*ptrs.size_freespace >= requiredSize);
+			assert(result != 0 || *ptrs.size_freespace >= requiredSize);
 
-			// update page directory
-			bool hasRemovedPage = pd.RemovePage(free_page, ptrs);
-			assert(hasRemovedPage);
+			// update free space map
+			fsm.RemovePage(free_page);
 		}
 		else
 		{
 			// there isn't any suitable page with free space; allocate new page
-			free_page = fh.GetNumberOfPages();
-			SetNewPagePointers(ptrs, rec);
-			fh.AppendPage(rec);
+			SetNewPagePointers(ptrs, rec, fh.GetPageSize());
+			result = fh.AppendPage(rec, free_page);
 		}
 
-		// Can we fit in the free space contiguous area?
-		if (static_cast<unsigned>(((char*)ptrs.last - (char*)(rec + *ptrs.freespace))) < recSize)
+		if (result == 0)
 		{
-			RearrangePage(ptrs, rec);
-			// After rearranging page, we should have enough space (assuming page directory had the information correct
-			assert(static_cast<unsigned>(((char*)ptrs.last - (char*)(rec + *ptrs.freespace))) >= recSize);
+			// insert tuple data, and obtain rid
+			rid.pageNum = free_page;
+			rid.slotNum = AddTupleToPage(ptrs, rec, intRepr, recSize);
+
+			// update free space map
+			bool isInserted = fsm.InsertFreePage(free_page, *ptrs.size_freespace);
+			assert(isInserted == fsm.HasSufficientSpace(*ptrs.size_freespace));
+			result = fsm.FlushDataToFile();
+
+			// write page to file
+			if (result == 0)
+				result = fh.WritePage(free_page,rec);
 		}
 
-		// insert tuple data
-		memcpy(rec + *ptrs.freespace,intRepr,recSize);
+		free(intRepr);
+		free(rec);
+
+		if (result != 0)
+			return AbortOperation(pf, catalogTable->tableName);
+		return CommitOperation(pf);
+	}
+	free(intRepr);
+	free(rec);
+	return -1;
+}
+
+RC RM::insertTuples(const string tableName, const vector<const void*> & tuples, vector<RID> & rids)
+{
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
+
+	return insertTuples(tableId, tuples, rids);
+}
+
+RC RM::insertTuples(const TableId tableId, const vector<const void*> & tuples, vector<RID> & rids)
+{
+	CatalogTable* catalogTable = GetCatalogTable(tableId);
+	if (catalogTable == NULL)
+		return -1;
+
+	OpenedTable* table = GetOpenedTable(pf, *catalogTable);
+	if (table == NULL)
+		return -1;
 
-		// Attempt to reuse slots if number of slots grows beyond our statically calculated average
-		newSlotPos = *ptrs.slots;
-		if (*ptrs.slots > AVGSLOTS)
+	TableInfo& tinf = *catalogTable->tableInfo;
+	PF_FileHandle& fh = table->fileHandle;
+	FreeSpaceMap& fsm = *table->freeSpaceMap;
+	unsigned pageSize = fh.GetPageSize();
+
+	// fill one page at a time: pages with free space first, then deallocated pages,
+	// then new pages, which are appended a batch at a time
+	rids.resize(tuples.size());
+	char* intRepr = (char*) malloc(GetMaxStoredTupleSize(tinf));
+	char* rec = (char*)malloc(pageSize);
+	vector<char> newPages;
+	PageNum firstNewPage = fh.GetNumberOfPages();
+	PageNum pageNum = 0;
+	PagePointers ptrs;
+	bool hasPage = false;
+	RC result = 0;
+	for (unsigned i = 0; i <= tuples.size() && result == 0; ++i)
+	{
+		unsigned recSize = 0;
+		unsigned requiredSize = 0;
+		if (i < tuples.size())
 		{
-			SlotStore* it;
-			it = ptrs.first;
-			for(unsigned i=0; i < *ptrs.slots; i++)
+			ExternalToStoredTupleFormat(tinf, catalogTable->tupleSchemas, tuples[i], intRepr, recSize);
+			requiredSize = recSize + sizeof(SlotStore);
+		}
+
+		// done with the page: existing pages are written right away, new ones with their batch
+		if (hasPage && (i == tuples.size() || *ptrs.size_freespace < requiredSize))
+		{
+			if (pageNum < firstNewPage)
+			{
+				fsm.InsertFreePage(pageNum, *ptrs.size_freespace);
+				if (fh.WritePage(pageNum, rec) != 0)
+					result = -1;
+			}
+			else
 			{
-				if (it->slotSize == 0 && it->slotPtr > PF_PAGE_SIZE)
+				newPages.insert(newPages.end(), rec, rec + pageSize);
+				if (newPages.size() == INSERT_BATCH_PAGES * pageSize)
 				{
-					// reusing previously deleted slot
-					newSlotPos = i;
-					it->slotSize = recSize;
-					it->slotPtr = *ptrs.freespace;
-					reused = true;
-					break;
+					result = AppendBatchPages(fh, fsm, newPages);
+					firstNewPage = fh.GetNumberOfPages();
 				}
-				it -= 1;
 			}
+			hasPage = false;
 		}
+		if (i == tuples.size() || result != 0)
+			break;
 
-		// obtain rid
-		rid.pageNum = free_page;
-		rid.slotNum = newSlotPos;
-
-		// update freespace position, update freespace size, update number of slots and add the new slot data
-		if (!reused)
+		// query the free space map for an existing page with sufficient free space, or start a new page
+		if (!hasPage)
 		{
-			// determine slot info
-			SlotStore newSlot;
-			newSlot.slotSize = recSize;
-			newSlot.slotPtr = *ptrs.freespace;
+			if (fsm.ObtainFreePage(requiredSize, pageNum))
+			{
+				if (fh.ReadPage(pageNum, rec) != 0)
+				{
+					result = -1;
+					break;
+				}
+				RetrievePagePointers(ptrs, rec, pageSize);
+				assert(*ptrs.size_freespace >= requiredSize);
 
-			assert(*ptrs.size_freespace >= (recSize + sizeof(SlotStore)));
-			*ptrs.size_freespace -= (recSize + sizeof(SlotStore));
-			assert(*ptrs.size_freespace < PF_PAGE_SIZE);
-			*ptrs.slots += 1;
-			*(--ptrs.last) = newSlot;
+				fsm.RemovePage(pageNum);
+			}
+			else if (fh.GetNumberOfFreePages() > 0)
+			{
+				// take a deallocated page; it is written like an existing page
+				SetNewPagePointers(ptrs, rec, pageSize);
+				if (fh.AppendPage(rec, pageNum) != 0)
+				{
+					result = -1;
+					break;
+				}
+				assert(pageNum < firstNewPage);
+			}
+			else
+			{
+				SetNewPagePointers(ptrs, rec, pageSize);
+				pageNum = firstNewPage + newPages.size() / pageSize;
+			}
+			hasPage = true;
 		}
-		*ptrs.freespace += recSize;
-
-		// update page directory (and the page's nextPage#)
-		bool isInserted = pd.InsertFreePage(free_page, *ptrs.size_freespace, *ptrs.nextPage);
-		assert(isInserted == pd.HasSufficientSpace(*ptrs.size_freespace));
-		pd.FlushDataToFile();
-
-		// write page to file
-		fh.WritePage(free_page,rec);
 
-		free(intRepr);
-		free(rec);
-
-		pf->CloseFile(fh);
-
-		return 0;
+		// insert tuple data, and obtain rid
+		rids[i].pageNum = pageNum;
+		rids[i].slotNum = AddTupleToPage(ptrs, rec, intRepr, recSize);
 	}
+	if (result == 0 && !newPages.empty())
+		result = AppendBatchPages(fh, fsm, newPages);
+
 	free(intRepr);
 	free(rec);
-	return -1;
+
+	// the free space map is written once for the whole batch
+	if (result != 0 || fsm.FlushDataToFile() != 0)
+		return AbortOperation(pf, catalogTable->tableName);
+	return CommitOperation(pf);
 }
 
 RC RM::deleteTuples(const string tableName)
 {
-	string tableFilename = getTableFilename(tableName);
-	PF_FileHandle fh;
-	if (pf->OpenFile(tableFilename.c_str(), fh) == 0)
-	{
-		// reset the directory of page(s)
-		PageDirectory pageDir(fh);
-		pageDir.ResetData();
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
 
-		// handle record pages
+	OpenedTable* table = GetOpenedTable(pf, *GetCatalogTable(tableId));
+	if (table != NULL)
+	{
+		// reset the free space map; a reorganization under way has nothing left to do
+		PF_FileHandle& fh = table->fileHandle;
+		FreeSpaceMap& fsm = *table->freeSpaceMap;
+		fsm.ResetData();
+		delete table->reorganization;
+		table->reorganization = NULL;
+
+		// every record page becomes an empty page; deallocated pages stay as
+		// they are, on the free page list
 		unsigned numPages = fh.GetNumberOfPages();
-		char pageData[PF_PAGE_SIZE];
+		unsigned pageSize = fh.GetPageSize();
+		vector<char> emptyPage(pageSize);
 		PagePointers pagePtrs;
-		for (unsigned i = 1; i < numPages; ++i)
+		SetNewPagePointers(pagePtrs, &emptyPage[0], pageSize);
+		vector<PageNum> pageNums;
+		for (PageNum pageNum = 1; pageNum < numPages; ++pageNum)
 		{
-			// read page data
-			if (fh.ReadPage(i, pageData) != 0)
+			if (!fh.IsPageFree(pageNum))
 			{
-				pf->CloseFile(fh);
-				return -1;
+				pageNums.push_back(pageNum);
+				fsm.InsertFreePage(pageNum, *pagePtrs.size_freespace);
 			}
-			
-			// reset page data
-			SetNewPagePointers(pagePtrs, pageData);
+		}
 
-			// insert page into directory of page(s)
-			pageDir.InsertFreePage(i, *pagePtrs.size_freespace, *pagePtrs.nextPage);
+		// flush free space map to file
+		if (fsm.FlushDataToFile() != 0)
+			return AbortOperation(pf, tableName);
 
-			// write page data to file
-			if (fh.WritePage(i, pageData) != 0)
-			{
-				pf->CloseFile(fh);
-				return -1;
-			}
+		// the pages are written last, in one call: the old contents are not
+		// needed, so they are logged whole, without being read, and written in
+		// runs of consecutive pages. That commits the operation
+		if (!pageNums.empty())
+		{
+			vector<const void*> pageData(pageNums.size(), &emptyPage[0]);
+			if (fh.WritePages(&pageNums[0], pageNums.size(), &pageData[0]) != 0)
+				return AbortOperation(pf, tableName);
 		}
 
-		// flush page directory to file
-		pageDir.FlushDataToFile();
-
-		pf->CloseFile(fh);
-		return 0;
+		return CommitOperation(pf);
 	}
 
 	return -1;
@@ -353,61 +704,61 @@ RC RM::deleteTuples(const string tableName)
 
 RC RM::deleteTuple(const string tableName, const RID & rid)
 {
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
+
+	return deleteTuple(tableId, rid);
+}
+
+RC RM::deleteTuple(const TableId tableId, const RID & rid)
+{
+	CatalogTable* catalogTable = GetCatalogTable(tableId);
+	if (catalogTable == NULL)
+		return -1;
+
 	PagePointers ptrs;
-	PF_FileHandle fh;
 	SlotStore* it;
-	char* rec = (char*)malloc(PF_PAGE_SIZE);
+	char* rec = NULL;
 
-	string tableFileName = getTableFilename(tableName);
-	if (pf->OpenFile(tableFileName.c_str(), fh) == 0)
+	OpenedTable* table = GetOpenedTable(pf, *catalogTable);
+	if (table != NULL)
 	{
+		PF_FileHandle& fh = table->fileHandle;
+		rec = (char*)malloc(fh.GetPageSize());
 		if (fh.ReadPage(rid.pageNum, rec) == 0)
 		{
-			PageDirectory pd(fh);
+			FreeSpaceMap& fsm = *table->freeSpaceMap;
 			{
-				// These PageDirectory operations are not atomic and are subject to crashes!
-				RetrievePagePointers(ptrs, rec);
-				if (pd.RemovePage(rid.pageNum,ptrs))
-				{
-					// update data
-					it = ptrs.first;
-					it -= rid.slotNum;
-					*ptrs.size_freespace += it->slotSize;
-					assert(*ptrs.size_freespace < PF_PAGE_SIZE);
-					it->slotSize = 0;
-					it->slotPtr = PF_PAGE_SIZE + 1; // Invalid pointer, to differentiate between updatetuple reallocation
-					
-					// insert pageNum into directory of page(s) using updated data
-					if (!pd.InsertFreePage(rid.pageNum, *ptrs.size_freespace, *ptrs.nextPage))
-					{
-						pf->CloseFile(fh);
-					    cout << "****Error: Could not reinsert Page in PageDirectory." << endl;
-						free(rec);
-						return -1;
-					}
+				// These FreeSpaceMap operations are made atomic by the log (see CommitOperation())
+				RetrievePagePointers(ptrs, rec, fh.GetPageSize());
 
-					// write data to file
-					if (fh.WritePage(rid.pageNum, rec) != 0)
-					{
-						cout << "****Error: Could not write Page data to file" << endl;
-						assert(false);
-					}
-					free(rec);
-				}
-				else
+				// a slot already deleted would be put on the free slot list twice
+				it = ptrs.first;
+				it -= rid.slotNum;
+				if (rid.slotNum >= *ptrs.slots || IsSlotFree(it, ptrs.pageSize))
 				{
-					pf->CloseFile(fh);
-					cout << "****Error: Could not remove Page from PageDirectory" << endl;
 					free(rec);
 					return -1;
 				}
+
+				// update data; the deleted slot goes on the page's free slot list
+				*ptrs.size_freespace += it->slotSize;
+				assert(*ptrs.size_freespace < ptrs.pageSize);
+				PushFreeSlot(ptrs, rid.slotNum);
+				
+				// move pageNum to the size class of its updated free space
+				fsm.InsertFreePage(rid.pageNum, *ptrs.size_freespace);
+
+				// write data to file
+				RC result = fh.WritePage(rid.pageNum, rec);
+				free(rec);
+				if (result != 0 || fsm.FlushDataToFile() != 0)
+					return AbortOperation(pf, catalogTable->tableName);
 			}
-			pd.FlushDataToFile();
-			pf->CloseFile(fh);
-			return 0;
+			return CommitOperation(pf);
 		}
-
-		pf->CloseFile(fh);
 	}
 	free(rec);
 	return -1;
@@ -415,37 +766,48 @@ RC RM::deleteTuple(const string tableName, const RID & rid)
 
 RC RM::updateTuple(const string tableName, const void *data, const RID & rid)
 {
-	if (!tableExists(tableName))
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
+
+	return updateTuple(tableId, data, rid);
+}
+
+RC RM::updateTuple(const TableId tableId, const void *data, const RID & rid)
+{
+	CatalogTable* catalogTable = GetCatalogTable(tableId);
+	if (catalogTable == NULL)
 		return -1;
 
 	// Modified record may not fit the new page!
 	PagePointers ptrs;
-	PF_FileHandle fh;
 	SlotStore* it;
 	char* int_tuple;
 	unsigned recSize = 0;
 
-	TableInfo tinf = _catalogAttrTable[tableName];
-	int_tuple = (char*) malloc(GetMaxInternalTupleSize(tinf));
-	ExternalToInternalTupleFormat(tinf, data, int_tuple, recSize);
+	TableInfo& tinf = *catalogTable->tableInfo;
+	int_tuple = (char*) malloc(GetMaxStoredTupleSize(tinf));
+	ExternalToStoredTupleFormat(tinf, catalogTable->tupleSchemas, data, int_tuple, recSize);
 
-	char* rec = (char*)malloc(PF_PAGE_SIZE);
-	string tableFileName = getTableFilename(tableName);
-	if (pf->OpenFile(tableFileName.c_str(), fh) == 0)
+	char* rec = NULL;
+	OpenedTable* table = GetOpenedTable(pf, *catalogTable);
+	if (table != NULL)
 	{
-		PageDirectory pd(fh);
+		PF_FileHandle& fh = table->fileHandle;
+		FreeSpaceMap& fsm = *table->freeSpaceMap;
+		rec = (char*)malloc(fh.GetPageSize());
 		if (fh.ReadPage(rid.pageNum, rec) == 0)
 		{
-			RetrievePagePointers(ptrs, rec);
+			RetrievePagePointers(ptrs, rec, fh.GetPageSize());
 			it = ptrs.first;
 			it -= rid.slotNum;
 
 			// Is the data here?
 			if (it->slotSize == 0)
 			{
-				if (it->slotPtr > PF_PAGE_SIZE)
+				if (it->slotPtr > ptrs.pageSize)
 				{
-					pf->CloseFile(fh);
 					free(rec);
 					free(int_tuple);
 					// Data was deleted! returning error
@@ -454,18 +816,16 @@ RC RM::updateTuple(const string tableName, const void *data, const RID & rid)
 				else
 				{
 					// Data was reallocated! Recursively call update to the new RID function
-					RID* newrid = (RID*)(rec + it->slotPtr);
-					updateTuple(tableName, data, *newrid);
-					pf->CloseFile(fh);
+					RID newrid = *(RID*)(rec + it->slotPtr);
 					free(rec);
 					free(int_tuple);
-					return 0;
+					return updateTuple(tableId, data, newrid);
 				}
 			}
 			else
 			{
 				if (recSize != it->slotSize)
-					pd.RemovePage(rid.pageNum,ptrs);
+					fsm.RemovePage(rid.pageNum);
 
 				// Can we fit the modified tuple on the same spot?
 				if (recSize > it->slotSize)
@@ -481,16 +841,30 @@ RC RM::updateTuple(const string tableName, const void *data, const RID & rid)
 						RID* slot = (RID*)(rec + it->slotPtr);
 						RID newlocation;
 
-						// 2. Call insertTuple to reinsert the data on another page
-						pd.FlushDataToFile();	// flush data to file so that insertTuple() gets the most updated data.
+						// 2. Call insertTuple to reinsert the data on another page; it shares the
+						// free space map, where this page is removed
 						{
-							insertTuple(tableName,data,newlocation);
+							// the insertion commits along with the update
+							bool wasInNestedOperation = isInNestedOperation;
+							isInNestedOperation = true;
+							RC result = insertTuple(tableId,data,newlocation);
+							isInNestedOperation = wasInNestedOperation;
+							if (result != 0)
+							{
+								free(rec);
+								free(int_tuple);
+								return AbortOperation(pf, catalogTable->tableName);
+							}
 						}
-						pd.ReloadData();	// reload data that may have been modified by insertTuple().
+
+						// a reorganization under way keeps the tombstone following the tuple
+						if (table->reorganization != NULL)
+							table->reorganization->forwardedFrom[newlocation] = rid;
+
 						slot->pageNum = newlocation.pageNum;
 						slot->slotNum = newlocation.slotNum;
 						*ptrs.size_freespace -= sizeof(RID);	// Warning: assumes that the previous location has a size >= sizeof(RID). However, in our case, this is always true.
-						assert(*ptrs.size_freespace < PF_PAGE_SIZE);
+						assert(*ptrs.size_freespace < ptrs.pageSize);
 					}
 					else
 					{
@@ -498,8 +872,8 @@ RC RM::updateTuple(const string tableName, const void *data, const RID & rid)
 						if ((unsigned)((char*)ptrs.last - (char*)(rec + *ptrs.freespace)) < recSize)
 						{
 							// indicate that the slot is deleted
-							it->slotPtr = PF_PAGE_SIZE + 1;	
-							assert(IsSlotFree(it));
+							it->slotPtr = GetDeletedSlotPtr(ptrs);
+							assert(IsSlotFree(it, ptrs.pageSize));
 
 							RearrangePage(ptrs,rec);
 
@@ -514,7 +888,7 @@ RC RM::updateTuple(const string tableName, const void *data, const RID & rid)
 
 						*ptrs.freespace += recSize;
 						*ptrs.size_freespace -= recSize;
-						assert(*ptrs.size_freespace < PF_PAGE_SIZE);
+						assert(*ptrs.size_freespace < ptrs.pageSize);
 					}
 
 				}
@@ -524,19 +898,20 @@ RC RM::updateTuple(const string tableName, const void *data, const RID & rid)
 					memcpy(rec + it->slotPtr,int_tuple, recSize);
 					assert(it->slotSize >= recSize);
 					*ptrs.size_freespace += (it->slotSize - recSize);
-					assert(*ptrs.size_freespace < PF_PAGE_SIZE);
+					assert(*ptrs.size_freespace < ptrs.pageSize);
 					it->slotSize = recSize;
 				}
-				pd.InsertFreePage(rid.pageNum, *ptrs.size_freespace, *ptrs.nextPage);
-				pd.FlushDataToFile();
-				fh.WritePage(rid.pageNum, rec);
+				fsm.InsertFreePage(rid.pageNum, *ptrs.size_freespace);
+				RC result = fsm.FlushDataToFile();
+				if (result == 0)
+					result = fh.WritePage(rid.pageNum, rec);
 				free(rec);
 				free(int_tuple);
-				pf->CloseFile(fh);
-				return 0;
+				if (result != 0)
+					return AbortOperation(pf, catalogTable->tableName);
+				return CommitOperation(pf);
 			}
 		}
-		pf->CloseFile(fh);
 	}
 	free(rec);
 	free(int_tuple);
@@ -545,28 +920,39 @@ RC RM::updateTuple(const string tableName, const void *data, const RID & rid)
 
 RC RM::readTuple(const string tableName, const RID & rid, void *data)
 {
-	if (!tableExists(tableName))
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
+
+	return readTuple(tableId, rid, data);
+}
+
+RC RM::readTuple(const TableId tableId, const RID & rid, void *data)
+{
+	CatalogTable* catalogTable = GetCatalogTable(tableId);
+	if (catalogTable == NULL)
 		return -1;
 
 	PagePointers ptrs;
-	PF_FileHandle fh;
 	SlotStore* it;
 	unsigned recSize = 0;
 
-	TableInfo tinf = _catalogAttrTable[tableName];
-	char* rec = (char*)malloc(PF_PAGE_SIZE);
-	string tableFileName = getTableFilename(tableName);
-	if (pf->OpenFile(tableFileName.c_str(), fh) == 0)
+	TableInfo& tinf = *catalogTable->tableInfo;
+	char* rec = NULL;
+	OpenedTable* table = GetOpenedTable(pf, *catalogTable);
+	if (table != NULL)
 	{
+		PF_FileHandle& fh = table->fileHandle;
+		rec = (char*)malloc(fh.GetPageSize());
 		if (fh.ReadPage(rid.pageNum, rec) == 0)
 		{
-			RetrievePagePointers(ptrs, rec);
+			RetrievePagePointers(ptrs, rec, fh.GetPageSize());
 
 			// check whether the slotnum is out-of-range
 			if (rid.slotNum >= *ptrs.slots)
 			{
 				free(rec);
-				pf->CloseFile(fh);
 				return -1;
 			}
 			else
@@ -575,19 +961,17 @@ RC RM::readTuple(const string tableName, const RID & rid, void *data)
 				it -= rid.slotNum;
 				if (it->slotSize > 0)
 				{
-					InternalToExternalTupleFormat(tinf, rec + it->slotPtr, data, recSize);
+					StoredToExternalTupleFormat(tinf, catalogTable->tupleSchemas, rec + it->slotPtr, data, recSize);
 					free(rec);
-					pf->CloseFile(fh);
 					return 0;
 				}
-				// slotSize = 0 -> slot deleted, slotPtr is valid ( < PF_PAGE_SIZE) -> it was reallocated
-				else if(it->slotSize == 0 && it->slotPtr < PF_PAGE_SIZE)
+				// slotSize = 0 -> slot deleted, slotPtr is valid ( < page size) -> it was reallocated
+				else if(it->slotSize == 0 && it->slotPtr < ptrs.pageSize)
 				{
 					RID* newrid = (RID*)(rec + it->slotPtr);
-					if (readTuple(tableName, *newrid, data) == 0)
+					if (readTuple(tableId, *newrid, data) == 0)
 					{
 						free(rec);
-						pf->CloseFile(fh);
 						return 0;
 					}
 					else
@@ -597,8 +981,6 @@ RC RM::readTuple(const string tableName, const RID & rid, void *data)
 				// else: Data was deleted, not reallocated. Free resources, return -1
 			}
 		}
-
-		pf->CloseFile(fh);
 	}
 	free(rec);
 	return -1;
@@ -606,30 +988,40 @@ RC RM::readTuple(const string tableName, const RID & rid, void *data)
 
 RC RM::readAttribute(const string tableName, const RID & rid, const string attributeName, void *data)
 {
-	if (!tableExists(tableName))
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
+
+	return readAttribute(tableId, rid, attributeName, data);
+}
+
+RC RM::readAttribute(const TableId tableId, const RID & rid, const string attributeName, void *data)
+{
+	CatalogTable* catalogTable = GetCatalogTable(tableId);
+	if (catalogTable == NULL)
 		return -1;
 
 	PagePointers ptrs;
-	PF_FileHandle fh;
 	SlotStore* ss;
-	vector<Attribute>::iterator it;
 
 	// retrieve tuple data
-	TableInfo tinf = _catalogAttrTable[tableName];
-	char* rec = (char*)malloc(PF_PAGE_SIZE);
+	TableInfo& tinf = *catalogTable->tableInfo;
+	char* rec = NULL;
 	char* slot;
-	string tableFileName = getTableFilename(tableName);
-	if (pf->OpenFile(tableFileName.c_str(), fh) == 0)
+	OpenedTable* table = GetOpenedTable(pf, *catalogTable);
+	if (table != NULL)
 	{
+		PF_FileHandle& fh = table->fileHandle;
+		rec = (char*)malloc(fh.GetPageSize());
 		if (fh.ReadPage(rid.pageNum, rec) == 0)
 		{
-			RetrievePagePointers(ptrs, rec);
+			RetrievePagePointers(ptrs, rec, fh.GetPageSize());
 
 			// check if slot# is in range
 			if (rid.slotNum >= *ptrs.slots)
 			{
 				free(rec);
-				pf->CloseFile(fh);
 				return -1;
 			}
 
@@ -642,55 +1034,35 @@ RC RM::readAttribute(const string tableName, const RID & rid, const string attri
 			if (ss->slotSize == 0)
 			{
 				// check if deleted
-				if (ss->slotPtr >= PF_PAGE_SIZE)
+				if (ss->slotPtr >= ptrs.pageSize)
 				{
 					free(rec);
-					pf->CloseFile(fh);
 					return -1;
 				}
 				else
 				{
 					// data has been moved to another page
-					RID* newRID = reinterpret_cast<RID*>(slot);
-					if (readTuple(tableName, *newRID, rec) != 0)
-					{
-						free(rec);
-						pf->CloseFile(fh);
-						return -1;
-					}
-
-					// re-obtain data
-					RetrievePagePointers(ptrs, rec);
-					ss = ptrs.first;
-					ss -= rid.slotNum;
-					slot = rec + ss->slotPtr;
+					RID newRID = *reinterpret_cast<RID*>(slot);
+					free(rec);
+					return readAttribute(tableId, newRID, attributeName, data);
 				}
 			}
 		}
 		else
 		{
 			free(rec);
-			pf->CloseFile(fh);
 			return -1;
 		}
-		pf->CloseFile(fh);
 	}
 
-	// retrieve attribute data
-	unsigned attrIndex = 0;
+	// retrieve attribute data; a dropped attribute can't be read
+	unsigned attrIndex;
 	unsigned dataSize;
-	for ( it=tinf.attribute.begin(); it < tinf.attribute.end(); it++, ++attrIndex )
+	if (table != NULL && FindValidAttribute(tinf, attributeName, attrIndex))
 	{
-		if (it->name == attributeName)
-		{
-			// check that the attribute is valid (i.e., not deleted)
-			if (!tinf.attrValidity[attrIndex])
-				break;
-
-			GetTupleAttribute(tinf, slot, attrIndex, data, dataSize);
-			free(rec);
-			return 0;
-		}
+		GetStoredTupleAttribute(tinf, catalogTable->tupleSchemas, slot, attrIndex, data, dataSize);
+		free(rec);
+		return 0;
 	}
 
 	free(rec);
@@ -699,32 +1071,34 @@ RC RM::readAttribute(const string tableName, const RID & rid, const string attri
 
 RC RM::reorganizePage(const string tableName, const unsigned  pageNumber)
 {
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
+
 	PagePointers ptrs;
-	PF_FileHandle fh;
 
-	char* rec = (char*)malloc(PF_PAGE_SIZE);
-	string tableFileName = getTableFilename(tableName);
-	if (pf->OpenFile(tableFileName.c_str(), fh) == 0)
+	char* rec = NULL;
+	OpenedTable* table = GetOpenedTable(pf, *GetCatalogTable(tableId));
+	if (table != NULL)
 	{
+		PF_FileHandle& fh = table->fileHandle;
+		rec = (char*)malloc(fh.GetPageSize());
 		if (fh.ReadPage(pageNumber, rec) == 0)
 		{
-			RetrievePagePointers(ptrs, rec);
+			RetrievePagePointers(ptrs, rec, fh.GetPageSize());
 			RearrangePage(ptrs,rec);
 
 			// write updated data to file
 			if (fh.WritePage(pageNumber, rec) != 0)
 			{
 				free(rec);
-				pf->CloseFile(fh);
-				return -1;
+				return AbortOperation(pf, tableName);
 			}
 
 			free(rec);
-			pf->CloseFile(fh);
-			return 0;
+			return CommitOperation(pf);
 		}
-
-		pf->CloseFile(fh);
 	}
 	free(rec);
 	return -1;
@@ -744,18 +1118,31 @@ RC RM::scan(const string tableName, const string conditionAttribute, const CompO
 	rm_ScanIterator._pFileHandle = new PF_FileHandle();
 	if (pf->OpenFile(tableFileName.c_str(), *rm_ScanIterator._pFileHandle) == 0)
 	{
-		// start at page 1 (i.e., first data page)
+		RC result = CheckTableFormat(*rm_ScanIterator._pFileHandle);
+		if (result != 0)
+		{
+			rm_ScanIterator.close();
+			return result;
+		}
+
+		// a scan reads every page once; keep it from evicting the pages cached for others
+		rm_ScanIterator._pFileHandle->SetAccessRing(SCAN_RING_PAGES);
+
+		// start at page 1 (i.e., first data page), or the first one after it that isn't deallocated
+		PF_FileHandle& fh = *rm_ScanIterator._pFileHandle;
 		rm_ScanIterator._currPageNum = 1;
+		while (rm_ScanIterator._currPageNum < fh.GetNumberOfPages() && fh.IsPageFree(rm_ScanIterator._currPageNum))
+			++rm_ScanIterator._currPageNum;
 
 		// retrieve page data and page related data
-		PF_FileHandle& fh = *rm_ScanIterator._pFileHandle;
 		if (rm_ScanIterator._currPageNum >= fh.GetNumberOfPages())
 		{
 			rm_ScanIterator._slotPtr = NULL;	// indicate that there is no data pages
 			return 0;
 		}
-		rm_ScanIterator._pFileHandle->ReadPage(rm_ScanIterator._currPageNum, rm_ScanIterator._pageData);
-		RetrievePagePointers(rm_ScanIterator._pagePtrs, rm_ScanIterator._pageData);
+		rm_ScanIterator._pageData.resize(fh.GetPageSize());
+		rm_ScanIterator._pFileHandle->ReadPage(rm_ScanIterator._currPageNum, &rm_ScanIterator._pageData[0]);
+		RetrievePagePointers(rm_ScanIterator._pagePtrs, &rm_ScanIterator._pageData[0], fh.GetPageSize());
 		rm_ScanIterator._slotPtr = rm_ScanIterator._pagePtrs.first;
 
 		// retrieve projected attr positions
@@ -763,7 +1150,7 @@ RC RM::scan(const string tableName, const string conditionAttribute, const CompO
 		unsigned attrPos;
 		for (unsigned i = 0; i < numProjectedAttrs; ++i)
 		{
-			if (!GetAttributePosition(rm_ScanIterator._tableInfo, attributeNames[i], attrPos))
+			if (!FindValidAttribute(rm_ScanIterator._tableInfo, attributeNames[i], attrPos))
 			{
 				rm_ScanIterator = RM_ScanIterator();
 				return -1;
@@ -778,21 +1165,13 @@ RC RM::scan(const string tableName, const string conditionAttribute, const CompO
 		// since some parameters can be empty or NULL, we need to do checking
 		if (compOp != NO_OP)
 		{
-			// get attribute type
-			Attribute attr;
-			if (!GetAttributeDetail(rm_ScanIterator._tableInfo, conditionAttribute, attr))
-			{
-				rm_ScanIterator = RM_ScanIterator();
-				return -1;
-			}
-			rm_ScanIterator._attrType = attr.type;
-
-			// get attribute position
-			if (!GetAttributePosition(rm_ScanIterator._tableInfo, conditionAttribute, rm_ScanIterator._compAttrPosition))
+			// get attribute position and type
+			if (!FindValidAttribute(rm_ScanIterator._tableInfo, conditionAttribute, rm_ScanIterator._compAttrPosition))
 			{
 				rm_ScanIterator = RM_ScanIterator();
 				return -1;
 			}
+			rm_ScanIterator._attrType = rm_ScanIterator._tableInfo.attribute[rm_ScanIterator._compAttrPosition].type;
 
 			// set comparison value
 			rm_ScanIterator._compValue = value;
@@ -806,35 +1185,188 @@ RC RM::scan(const string tableName, const string conditionAttribute, const CompO
 
 RC RM::dropAttribute(const string tableName, const string attributeName)
 {
-	return -1;
+	// the attributes of the catalog are fixed
+	if (CATALOG_ATTRIBUTES_TABLE_NAME == tableName)
+		return -1;
+
+	map<string, TableInfo>::iterator itr = _catalogAttrTable.find(tableName);
+	unsigned attrIndex;
+	if (itr == _catalogAttrTable.end() || !FindValidAttribute(itr->second, attributeName, attrIndex))
+		return -1;
+
+	// a table keeps at least one attribute
+	TableInfo& tinf = itr->second;
+	unsigned numValidAttrs = 0;
+	for (unsigned i = 0; i < tinf.attrValidity.size(); ++i)
+	{
+		if (tinf.attrValidity[i])
+			++numValidAttrs;
+	}
+	if (numValidAttrs == 1)
+		return -1;
+
+	// only the catalog changes: the attribute keeps its position, and the stored
+	// tuples keep their value of it, which is skipped when they are read. The
+	// catalog file gets a row with the negated position to mark it dropped.
+	RemoveCatalogSnapshot();	// out of date until the catalog file has the change
+	const Attribute& attr = tinf.attribute[attrIndex];
+	TupleItem packedTuple = TupleItem(attr.name) + TupleItem(tableName)
+							+ TupleItem(attr.type) + TupleItem(attr.length)
+							+ TupleItem(-static_cast<int>(attrIndex) - 1);
+	RID rid;
+	if (insertTuple(CATALOG_ATTRIBUTES_TABLE_NAME, packedTuple.GetData(), rid) != 0)
+		return -1;
+
+	tinf.attrValidity[attrIndex] = false;
+
+	SaveCatalogSnapshot(_catalogAttrTable);
+	return 0;
 }
 
 RC RM::addAttribute(const string tableName, const Attribute attr)
 {
-	return -1;
+	// the attributes of the catalog are fixed
+	if (CATALOG_ATTRIBUTES_TABLE_NAME == tableName)
+		return -1;
+
+	map<string, TableInfo>::iterator itr = _catalogAttrTable.find(tableName);
+	unsigned attrIndex;
+	if (itr == _catalogAttrTable.end() || FindValidAttribute(itr->second, attr.name, attrIndex))
+		return -1;
+
+	// only the catalog changes: the attribute goes after all others, dropped ones
+	// included, and the tuples stored before it read it as its default value
+	RemoveCatalogSnapshot();	// out of date until the catalog file has the change
+	TableInfo& tinf = itr->second;
+	unsigned position = tinf.attribute.size();
+	TupleItem packedTuple = TupleItem(attr.name) + TupleItem(tableName)
+							+ TupleItem(attr.type) + TupleItem(attr.length)
+							+ TupleItem(position);
+	RID rid;
+	if (insertTuple(CATALOG_ATTRIBUTES_TABLE_NAME, packedTuple.GetData(), rid) != 0)
+		return -1;
+
+	tinf.attribute.push_back(attr);
+	tinf.attrValidity.push_back(true);
+	tinf.maxInternalTupleSize = ComputeMaxInternalTupleSize(tinf.attribute);
+
+	SaveCatalogSnapshot(_catalogAttrTable);
+	return 0;
 }
 
 RC RM::reorganizeTable(const string tableName)
 {
-	return -1;
-}
+	// the whole table, committed a batch of pages at a time
+	bool isDone = false;
+	while (!isDone)
+	{
+		if (reorganizeTable(tableName, REORGANIZE_BATCH_PAGES, isDone) != 0)
+			return -1;
+	}
 
-///////////////////////////////////////////
-// RM Protected/Private Class Function Definitions
-///////////////////////////////////////////
+	return 0;
+}
 
-bool RM::loadAttributeCatalog()
+RC RM::reorganizeTable(const string tableName, const unsigned maxPages, bool & isDone)
 {
-	assert(_catalogAttrTable.empty());
+	// First every forwarding chain is collapsed: the tuple goes back to its home
+	// page if it fits there, otherwise the tombstone points straight at it. That
+	// keeps the RIDs valid, so it is done up to maxPages pages per call, each call
+	// committed; the table can be used between the calls, and the tombstones made
+	// by updateTuple() meanwhile are kept track of. Then the tuples are packed into
+	// the first pages, which moves them: the RIDs don't stay valid, and a scan
+	// would see pages half packed, so the packing is done whole by the call the
+	// collapsing ends in, as a single operation written a batch of pages at a time.
+	// A tombstone forwarding to a tuple that moves is made to follow it.
+	isDone = false;
+	if (maxPages == 0)
+		return -1;
+	TableId tableId;
+	RC result = openTable(tableName, tableId);
+	if (result != 0)
+		return result;
 
-	// construct temporary table information
-	vector<Attribute> catalogAttrs;
-	getAttributeCatalogAttributes(catalogAttrs);
-	unsigned maxTupleSize = ComputeMaxInternalTupleSize(catalogAttrs);		// compute max internal tuple size (to be stored in cached attribute catalog
-	
-	vector<bool> attrsValid;
-	for (unsigned i = 0; i < catalogAttrs.size(); ++i)
-		attrsValid.push_back(true);
+	OpenedTable* table = GetOpenedTable(pf, *GetCatalogTable(tableId));
+	if (table == NULL)
+		return -1;
+
+	if (table->reorganization == NULL)
+		table->reorganization = new TableReorganization();
+	TableReorganization& reorg = *table->reorganization;
+	PF_FileHandle& fh = table->fileHandle;
+	FreeSpaceMap& fsm = *table->freeSpaceMap;
+
+	// a failed batch is not written
+	PageBatch batch;
+	result = CollapseForwarding(fh, reorg, batch, maxPages);
+	if (result == 0)
+		result = WriteBatchPages(fh, fsm, reorg, batch, false);
+	while (result == 0 && reorg.isPacking && !isDone)
+	{
+		result = PackPages(fh, reorg, batch, REORGANIZE_BATCH_PAGES, isDone);
+		if (result == 0)
+			result = WriteBatchPages(fh, fsm, reorg, batch, isDone);
+	}
+	FreeBatchPages(batch);
+	if (result != 0)
+	{
+		// undo the call; the reorganization starts over next time
+		isDone = false;
+		return AbortOperation(pf, tableName);
+	}
+
+	if (isDone)
+	{
+		// the pages emptied by packing go on the free page list of the file, for
+		// any file to reuse; files too old to have one keep them in the free space map
+		char* rec = (char*)malloc(fh.GetPageSize());
+		PagePointers ptrs;
+		SetNewPagePointers(ptrs, rec, fh.GetPageSize());
+		for (PageNum pageNum = reorg.outputPage + 1; pageNum < fh.GetNumberOfPages(); ++pageNum)
+		{
+			if (fh.IsPageFree(pageNum))
+				continue;
+
+			if (fh.DeallocatePage(pageNum) == 0)
+				fsm.RemovePage(pageNum);
+			else
+				fsm.InsertFreePage(pageNum, *ptrs.size_freespace);
+		}
+		free(rec);
+
+		delete table->reorganization;
+		table->reorganization = NULL;
+		if (fsm.FlushDataToFile() != 0)
+			return AbortOperation(pf, tableName);
+	}
+
+	return CommitOperation(pf);
+}
+
+///////////////////////////////////////////
+// RM Protected/Private Class Function Definitions
+///////////////////////////////////////////
+
+bool RM::loadAttributeCatalog()
+{
+	assert(_catalogAttrTable.empty());
+
+	// the snapshot has the whole catalog in a single read; the attributes table
+	// is scanned only when the snapshot is missing or out of date
+	if (LoadCatalogSnapshot(_catalogAttrTable))
+	{
+		IndexCatalog(_catalogAttrTable);
+		return true;
+	}
+
+	// construct temporary table information
+	vector<Attribute> catalogAttrs;
+	getAttributeCatalogAttributes(catalogAttrs);
+	unsigned maxTupleSize = ComputeMaxInternalTupleSize(catalogAttrs);		// compute max internal tuple size (to be stored in cached attribute catalog
+	
+	vector<bool> attrsValid;
+	for (unsigned i = 0; i < catalogAttrs.size(); ++i)
+		attrsValid.push_back(true);
 
 	TableInfo tableInfo = {catalogAttrs, attrsValid, maxTupleSize};
 
@@ -846,7 +1378,8 @@ bool RM::loadAttributeCatalog()
 	// scan all tuples into attribute catalog cache
 	string attrName, tableName;
 	int attrType, attrLength, attrPosition;
-	map<string, vector<unsigned> > attrPositionsMap;
+	map<string, vector<pair<unsigned, Attribute> > > tableAttrs;
+	map<string, set<unsigned> > droppedPositions;
 	unsigned numAttributes = catalogAttrs.size();
 	RID rid;
 	char* data = new char[tableInfo.maxInternalTupleSize];
@@ -888,45 +1421,40 @@ bool RM::loadAttributeCatalog()
 			}
 		}
 
-		// insert tuple into cached catalog
-		Attribute attr(attrName, static_cast<AttrType>(attrType), attrLength);
-		TableInfo& tInfo = _catalogAttrTable[tableName];
-		if (tInfo.attribute.empty())
+		// a negated position marks the attribute at that position dropped
+		if (attrPosition < 0)
 		{
-			tInfo.attribute.push_back(attr);
-			attrPositionsMap[tableName].push_back(attrPosition);
+			droppedPositions[tableName].insert(static_cast<unsigned>(-attrPosition - 1));
+			continue;
 		}
-		else
-		{
-			// put attribute tuple into appropriate order (in the vector) based on its position
-			vector<Attribute>::reverse_iterator attrItr = tInfo.attribute.rend();
-			vector<unsigned>& positions = attrPositionsMap[tableName];
-			vector<unsigned>::reverse_iterator posItr = positions.rend();
-			while (posItr < positions.rend())
-			{
-				if (static_cast<unsigned>(attrPosition) > *posItr)
-				{
-					tInfo.attribute.insert((attrItr+1).base(), attr);
-					positions.insert((posItr+1).base(), attrPosition);
-				}
 
-				// update iterators
-				++attrItr;
-				++posItr;
-			}
-		}
-		tInfo.attrValidity.push_back(true);
+		// collect the attributes of each table along with their positions
+		Attribute attr(attrName, static_cast<AttrType>(attrType), attrLength);
+		tableAttrs[tableName].push_back(make_pair(static_cast<unsigned>(attrPosition), attr));
 	}
 	delete [] data;
 
-	// compute necessary TableInfo data
-	map<string, TableInfo>::iterator mapItr = _catalogAttrTable.begin();
-	while(mapItr != _catalogAttrTable.end())
+	// insert the attributes into cached catalog, ordered by position
+	map<string, vector<pair<unsigned, Attribute> > >::iterator attrsItr;
+	for (attrsItr = tableAttrs.begin(); attrsItr != tableAttrs.end(); ++attrsItr)
 	{
-		mapItr->second.maxInternalTupleSize = ComputeMaxInternalTupleSize(mapItr->second.attribute);
-		++mapItr;
+		vector<pair<unsigned, Attribute> >& attrs = attrsItr->second;
+		sort(attrs.begin(), attrs.end(), AttributePositionLess);
+
+		TableInfo& tInfo = _catalogAttrTable[attrsItr->first];
+		const set<unsigned>& dropped = droppedPositions[attrsItr->first];
+		for (unsigned i = 0; i < attrs.size(); ++i)
+		{
+			tInfo.attribute.push_back(attrs[i].second);
+			tInfo.attrValidity.push_back(dropped.count(attrs[i].first) == 0);
+		}
 	}
 
+	IndexCatalog(_catalogAttrTable);
+
+	// the next startup reads the snapshot instead
+	SaveCatalogSnapshot(_catalogAttrTable);
+
 	return true;
 }
 
@@ -980,22 +1508,38 @@ bool RM::getSequentialScanIterator(const TableInfo& tableInfo, const string& tab
 	rm_ScanIterator._pFileHandle = new PF_FileHandle();
 	if (pf->OpenFile(tableFileName.c_str(), *rm_ScanIterator._pFileHandle) == 0)
 	{
-		// start at page 1 (i.e., first data page)
+		if (CheckTableFormat(*rm_ScanIterator._pFileHandle) != 0)
+		{
+			rm_ScanIterator.close();
+			return false;
+		}
+
+		// a scan reads every page once; keep it from evicting the pages cached for others
+		rm_ScanIterator._pFileHandle->SetAccessRing(SCAN_RING_PAGES);
+
+		// start at page 1 (i.e., first data page), or the first one after it that isn't deallocated
+		PF_FileHandle& fh = *rm_ScanIterator._pFileHandle;
 		rm_ScanIterator._currPageNum = 1;
+		while (rm_ScanIterator._currPageNum < fh.GetNumberOfPages() && fh.IsPageFree(rm_ScanIterator._currPageNum))
+			++rm_ScanIterator._currPageNum;
 
 		// retrieve page data and page related data
-		PF_FileHandle& fh = *rm_ScanIterator._pFileHandle;
 		if (rm_ScanIterator._currPageNum >= fh.GetNumberOfPages())
 		{
 			rm_ScanIterator._slotPtr = NULL;	// indicate that there is no data pages
 			return true;
 		}
-		rm_ScanIterator._pFileHandle->ReadPage(rm_ScanIterator._currPageNum, rm_ScanIterator._pageData);
-		RetrievePagePointers(rm_ScanIterator._pagePtrs, rm_ScanIterator._pageData);
+		rm_ScanIterator._pageData.resize(fh.GetPageSize());
+		rm_ScanIterator._pFileHandle->ReadPage(rm_ScanIterator._currPageNum, &rm_ScanIterator._pageData[0]);
+		RetrievePagePointers(rm_ScanIterator._pagePtrs, &rm_ScanIterator._pageData[0], fh.GetPageSize());
 		rm_ScanIterator._slotPtr = rm_ScanIterator._pagePtrs.first;
 
-		// retrieve projected attr positions
-		GetAllAttributePositions(tableInfo, rm_ScanIterator._attrPositions);
+		// retrieve projected attr positions (i.e., those of all attributes that weren't dropped)
+		for (unsigned i = 0; i < tableInfo.attribute.size(); ++i)
+		{
+			if (tableInfo.attrValidity[i])
+				rm_ScanIterator._attrPositions.push_back(i);
+		}
 
 		// set comparison operation to no operation so that we can scan all records
 		rm_ScanIterator._compOp = NO_OP;
@@ -1040,14 +1584,16 @@ RC RM_ScanIterator::getNextTuple(RID &rid, void* data)
 		// check whether we're done with this page
 		if (_slotPtr < _pagePtrs.last)
 		{
-			// go to next page
+			// go to next page, past the deallocated ones
 			assert(_currPageNum <= _pFileHandle->GetNumberOfPages());
-			++_currPageNum;
+			do
+				++_currPageNum;
+			while (_currPageNum < _pFileHandle->GetNumberOfPages() && _pFileHandle->IsPageFree(_currPageNum));
 
 			if (_currPageNum < _pFileHandle->GetNumberOfPages())
 			{
-				_pFileHandle->ReadPage(_currPageNum, _pageData);
-				RetrievePagePointers(_pagePtrs, _pageData);
+				_pFileHandle->ReadPage(_currPageNum, &_pageData[0]);
+				RetrievePagePointers(_pagePtrs, &_pageData[0], _pageData.size());
 				_slotPtr = _pagePtrs.first;
 			}
 			else
@@ -1069,7 +1615,7 @@ RC RM_ScanIterator::getNextTuple(RID &rid, void* data)
 		{
 			// get attribute data
 			unsigned dataSize;
-			GetTupleAttribute(_tableInfo, _pageData + _slotPtr->slotPtr, _compAttrPosition, tempData, dataSize);
+			GetStoredTupleAttribute(_tableInfo, _tupleSchemas, &_pageData[_slotPtr->slotPtr], _compAttrPosition, tempData, dataSize);
 
 			// do comparison
 			if (_attrType == TypeVarChar)
@@ -1125,7 +1671,7 @@ RC RM_ScanIterator::getNextTuple(RID &rid, void* data)
 		for (unsigned i = 0; i < numAttrs; ++i)
 		{
 			// output attribute data
-			GetTupleAttribute(_tableInfo, _pageData + _slotPtr->slotPtr, _attrPositions[i], dataPtr + dataOffset, attrDataSize);
+			GetStoredTupleAttribute(_tableInfo, _tupleSchemas, &_pageData[_slotPtr->slotPtr], _attrPositions[i], dataPtr + dataOffset, attrDataSize);
 
 			// update offset
 			dataOffset += attrDataSize;
@@ -1284,7 +1830,1250 @@ bool RM_ScanIterator::Compare(const float attrData, const float compValue) const
 	return false;
 }
 
+///////////////////////////////////////////
+// FreeSpaceMap Class Function Definitions
+///////////////////////////////////////////
+
+FreeSpaceMap::FreeSpaceMap()
+	: _classBytes(PF_PAGE_SIZE / FREE_SPACE_CLASSES)
+{
+	memset(_nonEmptyBuckets, 0, sizeof(_nonEmptyBuckets));
+}
+
+RC FreeSpaceMap::Open(PF_Manager* pf, const string& tableFileName, PF_FileHandle& tableHandle)
+{
+	// the map is created on first use, for tables that predate it too
+	string fileName = GetFreeSpaceMapFilename(tableFileName);
+	bool isCreated = false;
+	if (pf->OpenFile(fileName.c_str(), _fileHandle) != 0)
+	{
+		if (pf->CreateFile(fileName.c_str(), PF_PAGE_SIZE) != 0)
+			return -1;
+		isCreated = true;
+		if (pf->OpenFile(fileName.c_str(), _fileHandle) != 0)
+		{
+			pf->DestroyFile(fileName.c_str());
+			return -1;
+		}
+	}
+
+	// logged like the table, so that the map and the pages survive a crash together
+	_classBytes = tableHandle.GetPageSize() / FREE_SPACE_CLASSES;
+	if (_fileHandle.GetPageSize() != PF_PAGE_SIZE
+		|| _fileHandle.EnableLogging() != 0
+		|| LoadData(tableHandle) != 0)
+	{
+		pf->CloseFile(_fileHandle);
+		if (isCreated)
+			pf->DestroyFile(fileName.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+RC FreeSpaceMap::Close(PF_Manager* pf)
+{
+	return pf->CloseFile(_fileHandle);
+}
+
+bool FreeSpaceMap::ObtainFreePage(unsigned requiredSize, PageNum& pageNum) const
+{
+	// every page of a class has at least the free bytes the class stands for,
+	// so the first non-empty bucket from the class of requiredSize (rounded up) has one
+	unsigned sizeClass = max(1U, (requiredSize + _classBytes - 1) / _classBytes);
+	for (unsigned word = sizeClass / 64; word < FREE_SPACE_CLASSES / 64; ++word)
+	{
+		unsigned long long bits = _nonEmptyBuckets[word];
+		if (word == sizeClass / 64)
+			bits &= ~0ULL << (sizeClass % 64);
+		if (bits != 0)
+		{
+			// the page put in the bucket last is the likeliest to be in the buffer pool
+			pageNum = _buckets[word * 64 + __builtin_ctzll(bits)].back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void FreeSpaceMap::RemovePage(PageNum pageNum)
+{
+	SetClass(pageNum, 0);
+}
+
+bool FreeSpaceMap::InsertFreePage(PageNum pageNum, unsigned freeSize)
+{
+	SetClass(pageNum, min(freeSize / _classBytes, FREE_SPACE_CLASSES - 1));
+
+	return HasSufficientSpace(freeSize);
+}
+
+void FreeSpaceMap::ResetData()
+{
+	for (unsigned i = 0; i < FREE_SPACE_CLASSES; ++i)
+		_buckets[i].clear();
+	memset(_nonEmptyBuckets, 0, sizeof(_nonEmptyBuckets));
+
+	_classes.assign(_classes.size(), 0);
+	for (PageNum pageNum = 0; pageNum < _classes.size(); pageNum += PF_PAGE_SIZE)
+		_dirtyMapPages.insert(pageNum / PF_PAGE_SIZE);
+}
+
+RC FreeSpaceMap::FlushDataToFile()
+{
+	vector<char> pageData(PF_PAGE_SIZE);
+	set<PageNum>::iterator itr;
+	for (itr = _dirtyMapPages.begin(); itr != _dirtyMapPages.end(); ++itr)
+	{
+		// a page past the end of the file is appended along with the ones before it
+		PageNum numMapPages = _fileHandle.GetNumberOfPages();
+		for (PageNum mapPage = min(*itr, numMapPages); mapPage <= *itr; ++mapPage)
+		{
+			PageNum first = mapPage * PF_PAGE_SIZE;
+			unsigned count = first < _classes.size() ? min(PF_PAGE_SIZE, static_cast<unsigned>(_classes.size() - first)) : 0;
+			memset(&pageData[0], 0, PF_PAGE_SIZE);
+			if (count > 0)
+				memcpy(&pageData[0], &_classes[first], count);
+
+			RC result = mapPage < numMapPages ? _fileHandle.WritePage(mapPage, &pageData[0]) : _fileHandle.AppendPage(&pageData[0]);
+			if (result != 0)
+				return -1;
+		}
+	}
+	_dirtyMapPages.clear();
+
+	return 0;
+}
+
+bool FreeSpaceMap::HasSufficientSpace(unsigned freeSize) const
+{
+	return freeSize >= _classBytes;
+}
+
+RC FreeSpaceMap::LoadData(PF_FileHandle& tableHandle)
+{
+	// the classes of the pages the map has; the map may be short of the table
+	// when it was just created, or was started by an operation that never committed
+	unsigned numPages = tableHandle.GetNumberOfPages();
+	unsigned numMapPages = _fileHandle.GetNumberOfPages();
+	unsigned numMapped = min(numPages, numMapPages * PF_PAGE_SIZE);
+	_classes.assign(numPages, 0);
+	_positions.assign(numPages, 0);
+
+	vector<char> batchData(FREE_SPACE_BATCH_PAGES * PF_PAGE_SIZE);
+	for (PageNum first = 0; first * PF_PAGE_SIZE < numMapped; first += FREE_SPACE_BATCH_PAGES)
+	{
+		unsigned count = min(FREE_SPACE_BATCH_PAGES, numMapPages - first);
+		if (_fileHandle.ReadPages(first, count, &batchData[0]) != 0)
+			return -1;
+
+		PageNum end = min(numMapped, (first + count) * PF_PAGE_SIZE);
+		for (PageNum pageNum = first * PF_PAGE_SIZE; pageNum < end; ++pageNum)
+		{
+			_classes[pageNum] = static_cast<unsigned char>(batchData[pageNum - first * PF_PAGE_SIZE]);
+			if (_classes[pageNum] != 0)
+				AddToBucket(pageNum, _classes[pageNum]);
+		}
+	}
+
+	// the rest come from the pages themselves (page 0 is the directory)
+	PagePointers pagePtrs;
+	unsigned pageSize = tableHandle.GetPageSize();
+	batchData.resize(FREE_SPACE_BATCH_PAGES * pageSize);
+	for (PageNum first = max(numMapped, 1U); first < numPages; first += FREE_SPACE_BATCH_PAGES)
+	{
+		unsigned count = min(FREE_SPACE_BATCH_PAGES, numPages - first);
+		if (tableHandle.ReadPages(first, count, &batchData[0]) != 0)
+			return -1;
+
+		for (unsigned i = 0; i < count; ++i)
+		{
+			// deallocated pages take no tuples until they are appended again
+			_dirtyMapPages.insert((first + i) / PF_PAGE_SIZE);
+			if (tableHandle.IsPageFree(first + i))
+				continue;
+
+			RetrievePagePointers(pagePtrs, &batchData[i * pageSize], pageSize);
+			InsertFreePage(first + i, *pagePtrs.size_freespace);
+		}
+	}
+
+	return FlushDataToFile();
+}
+
+void FreeSpaceMap::SetClass(PageNum pageNum, unsigned sizeClass)
+{
+	// pages appended to the table join the map as they are inserted
+	if (pageNum >= _classes.size())
+	{
+		for (PageNum mapPage = _classes.size() / PF_PAGE_SIZE; mapPage <= pageNum / PF_PAGE_SIZE; ++mapPage)
+			_dirtyMapPages.insert(mapPage);
+		_classes.resize(pageNum + 1, 0);
+		_positions.resize(pageNum + 1, 0);
+	}
+
+	if (_classes[pageNum] == sizeClass)
+		return;
+
+	if (_classes[pageNum] != 0)
+		RemoveFromBucket(pageNum);
+	if (sizeClass != 0)
+		AddToBucket(pageNum, sizeClass);
+
+	_classes[pageNum] = static_cast<unsigned char>(sizeClass);
+	_dirtyMapPages.insert(pageNum / PF_PAGE_SIZE);
+}
+
+void FreeSpaceMap::AddToBucket(PageNum pageNum, unsigned sizeClass)
+{
+	vector<PageNum>& bucket = _buckets[sizeClass];
+	_positions[pageNum] = bucket.size();
+	bucket.push_back(pageNum);
+	_nonEmptyBuckets[sizeClass / 64] |= 1ULL << (sizeClass % 64);
+}
+
+void FreeSpaceMap::RemoveFromBucket(PageNum pageNum)
+{
+	// the last page of the bucket takes the place of the one removed
+	unsigned sizeClass = _classes[pageNum];
+	vector<PageNum>& bucket = _buckets[sizeClass];
+	PageNum lastPage = bucket.back();
+	bucket[_positions[pageNum]] = lastPage;
+	_positions[lastPage] = _positions[pageNum];
+	bucket.pop_back();
+
+	if (bucket.empty())
+		_nonEmptyBuckets[sizeClass / 64] &= ~(1ULL << (sizeClass % 64));
+}
+
 ///////////////////////////////////////////
 // Helper Function Definitions
 ///////////////////////////////////////////
 
+unsigned ComputeHash(const void* data, size_t size)
+{
+	// FNV-1a
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+	unsigned hash = 2166136261U;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+unsigned HashTableName(const string& tableName)
+{
+	return ComputeHash(tableName.data(), tableName.size());
+}
+
+TableId FindTableId(const string& tableName)
+{
+	if (catalogIndex.empty())
+		return INVALID_TABLE_ID;
+
+	unsigned mask = catalogIndex.size() - 1;
+	for (unsigned slot = HashTableName(tableName) & mask; catalogIndex[slot] != INVALID_TABLE_ID; slot = (slot + 1) & mask)
+	{
+		if (catalogTables[catalogIndex[slot]].tableName == tableName)
+			return catalogIndex[slot];
+	}
+
+	return INVALID_TABLE_ID;
+}
+
+TableId InternTableName(const string& tableName)
+{
+	TableId tableId = FindTableId(tableName);
+	if (tableId != INVALID_TABLE_ID)
+		return tableId;
+
+	// keep the index at most half full; names are never removed from it
+	tableId = catalogTables.size();
+	if (2 * (tableId + 1) > catalogIndex.size())
+	{
+		unsigned numSlots = max(MIN_CATALOG_INDEX_SLOTS, 2 * static_cast<unsigned>(catalogIndex.size()));
+		catalogIndex.assign(numSlots, INVALID_TABLE_ID);
+		for (TableId i = 0; i < tableId; ++i)
+		{
+			unsigned slot = HashTableName(catalogTables[i].tableName) & (numSlots - 1);
+			while (catalogIndex[slot] != INVALID_TABLE_ID)
+				slot = (slot + 1) & (numSlots - 1);
+			catalogIndex[slot] = i;
+		}
+	}
+
+	CatalogTable catalogTable = {tableName, NULL, NULL, vector<TableInfo>()};
+	catalogTables.push_back(catalogTable);
+
+	unsigned mask = catalogIndex.size() - 1;
+	unsigned slot = HashTableName(tableName) & mask;
+	while (catalogIndex[slot] != INVALID_TABLE_ID)
+		slot = (slot + 1) & mask;
+	catalogIndex[slot] = tableId;
+
+	return tableId;
+}
+
+CatalogTable* GetCatalogTable(TableId tableId)
+{
+	if (tableId >= catalogTables.size() || catalogTables[tableId].tableInfo == NULL)
+		return NULL;
+
+	return &catalogTables[tableId];
+}
+
+OpenedTable* GetOpenedTable(PF_Manager* pf, CatalogTable& catalogTable)
+{
+	// open the table file on first use
+	if (catalogTable.openedTable == NULL && OpenTableFile(pf, catalogTable) != 0)
+		return NULL;
+
+	return catalogTable.openedTable;
+}
+
+RC OpenTableFile(PF_Manager* pf, CatalogTable& catalogTable)
+{
+	OpenedTable* table = new OpenedTable();
+	string tableFileName = getTableFilename(catalogTable.tableName);
+	if (pf->OpenFile(tableFileName.c_str(), table->fileHandle) != 0)
+	{
+		delete table;
+		return -1;
+	}
+
+	// refuse a file of an older format, and log the changes made through the table
+	RC result = CheckTableFormat(table->fileHandle);
+	if (result == 0 && table->fileHandle.EnableLogging() != 0)
+		result = -1;
+	if (result != 0)
+	{
+		pf->CloseFile(table->fileHandle);
+		delete table;
+		return result;
+	}
+	table->reorganization = NULL;
+	table->freeSpaceMap = new FreeSpaceMap();
+	if (table->freeSpaceMap->Open(pf, tableFileName, table->fileHandle) != 0)
+	{
+		delete table->freeSpaceMap;
+		pf->CloseFile(table->fileHandle);
+		delete table;
+		return -1;
+	}
+
+	catalogTable.openedTable = table;
+	return 0;
+}
+
+void CloseOpenedTable(PF_Manager* pf, const string& tableName)
+{
+	TableId tableId = FindTableId(tableName);
+	if (tableId == INVALID_TABLE_ID || catalogTables[tableId].openedTable == NULL)
+		return;
+
+	OpenedTable* table = catalogTables[tableId].openedTable;
+	catalogTables[tableId].openedTable = NULL;
+
+	table->freeSpaceMap->Close(pf);
+	delete table->freeSpaceMap;
+	delete table->reorganization;
+	pf->CloseFile(table->fileHandle);
+	delete table;
+}
+
+void CloseAllOpenedTables(PF_Manager* pf)
+{
+	for (unsigned i = 0; i < catalogTables.size(); ++i)
+		CloseOpenedTable(pf, catalogTables[i].tableName);
+}
+
+RC CommitOperation(PF_Manager* pf)
+{
+	// the page changes of a tuple operation survive a crash together or not at
+	// all; an operation nested in another one commits with the outer one
+	if (isInNestedOperation)
+		return 0;
+
+	return pf->Commit();
+}
+
+RC AbortOperation(PF_Manager* pf, const string& tableName)
+{
+	// a failed tuple operation undoes the changes it made to the files; the
+	// free space map and reorganization state in memory may be ahead of them,
+	// so the table is closed and loaded from the files on next use. An
+	// operation nested in another one is undone with the outer one
+	if (!isInNestedOperation)
+	{
+		pf->Abort();
+		CloseOpenedTable(pf, tableName);
+	}
+
+	return -1;
+}
+
+unsigned AddTupleToPage(PagePointers& ptrs, char*& rec, const char* intRepr, unsigned recSize)
+{
+	// reuse a deleted slot if the page has one, otherwise the tuple needs a new slot too
+	unsigned slotNum;
+	bool reused = PopFreeSlot(ptrs, slotNum);
+	unsigned contiguousSize = reused ? recSize : recSize + sizeof(SlotStore);
+
+	// Can we fit in the free space contiguous area?
+	if (static_cast<unsigned>(((char*)ptrs.last - (char*)(rec + *ptrs.freespace))) < contiguousSize)
+	{
+		RearrangePage(ptrs, rec);
+		// After rearranging page, we should have enough space (assuming the free space map had the information correct
+		assert(static_cast<unsigned>(((char*)ptrs.last - (char*)(rec + *ptrs.freespace))) >= contiguousSize);
+	}
+
+	// insert tuple data
+	memcpy(rec + *ptrs.freespace,intRepr,recSize);
+
+	// update freespace position, update freespace size, and fill in the reused slot or add the new one
+	if (reused)
+	{
+		SlotStore* it = ptrs.first;
+		it -= slotNum;
+		it->slotSize = recSize;
+		it->slotPtr = *ptrs.freespace;
+
+		assert(*ptrs.size_freespace >= recSize);
+		*ptrs.size_freespace -= recSize;
+	}
+	else
+	{
+		// determine slot info
+		SlotStore newSlot;
+		newSlot.slotSize = recSize;
+		newSlot.slotPtr = *ptrs.freespace;
+
+		assert(*ptrs.size_freespace >= (recSize + sizeof(SlotStore)));
+		*ptrs.size_freespace -= (recSize + sizeof(SlotStore));
+		assert(*ptrs.size_freespace < ptrs.pageSize);
+		slotNum = *ptrs.slots;
+		*ptrs.slots += 1;
+		*(--ptrs.last) = newSlot;
+	}
+	*ptrs.freespace += recSize;
+
+	return slotNum;
+}
+
+unsigned GetDeletedSlotPtr(const PagePointers& ptrs)
+{
+	// just past the page, so no tuple or tombstone is there; the free slot list adds the next free slot
+	return ptrs.pageSize + 1;
+}
+
+void PushFreeSlot(PagePointers& ptrs, unsigned slotNum)
+{
+	if ((*ptrs.nextPage & ~FREE_SLOT_LIST_MASK) != FREE_SLOT_LIST_TAG)
+		BuildFreeSlotList(ptrs);
+
+	// the deleted slot's slotPtr stays past the page: GetDeletedSlotPtr() plus the next free slot
+	SlotStore* it = ptrs.first;
+	it -= slotNum;
+	it->slotSize = 0;
+	it->slotPtr = GetDeletedSlotPtr(ptrs) + (*ptrs.nextPage & FREE_SLOT_LIST_MASK);
+	*ptrs.nextPage = FREE_SLOT_LIST_TAG | slotNum;
+}
+
+bool PopFreeSlot(PagePointers& ptrs, unsigned& slotNum)
+{
+	// a page written before the list, or whose list RearrangePage() didn't keep,
+	// has it rebuilt; the list is trusted only as far as it leads to deleted slots
+	for (unsigned attempt = 0; attempt < 2; ++attempt)
+	{
+		if (attempt > 0 || (*ptrs.nextPage & ~FREE_SLOT_LIST_MASK) != FREE_SLOT_LIST_TAG)
+			BuildFreeSlotList(ptrs);
+
+		slotNum = *ptrs.nextPage & FREE_SLOT_LIST_MASK;
+		if (slotNum == FREE_SLOT_LIST_END)
+			return false;
+
+		if (slotNum < *ptrs.slots)
+		{
+			SlotStore* it = ptrs.first;
+			it -= slotNum;
+			unsigned nextSlotNum = it->slotPtr - GetDeletedSlotPtr(ptrs);
+			if (IsSlotFree(it, ptrs.pageSize) && (nextSlotNum == FREE_SLOT_LIST_END || nextSlotNum < *ptrs.slots))
+			{
+				*ptrs.nextPage = FREE_SLOT_LIST_TAG | nextSlotNum;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void BuildFreeSlotList(PagePointers& ptrs)
+{
+	// thread the deleted slots together, lowest first
+	unsigned head = FREE_SLOT_LIST_END;
+	SlotStore* it = ptrs.last;
+	for (unsigned i = *ptrs.slots; i > 0; --i, ++it)
+	{
+		if (IsSlotFree(it, ptrs.pageSize))
+		{
+			it->slotPtr = GetDeletedSlotPtr(ptrs) + head;
+			head = i - 1;
+		}
+	}
+
+	*ptrs.nextPage = FREE_SLOT_LIST_TAG | head;
+}
+
+bool IsSameRID(const RID& lhs, const RID& rhs)
+{
+	return lhs.pageNum == rhs.pageNum && lhs.slotNum == rhs.slotNum;
+}
+
+bool GetForwardingRID(const PagePointers& ptrs, const char* rec, unsigned slotNum, RID& target)
+{
+	// a tuple moved by updateTuple() leaves its slot without size, pointing at the RID it moved to
+	if (slotNum >= *ptrs.slots)
+		return false;
+
+	SlotStore* it = ptrs.first;
+	it -= slotNum;
+	if (it->slotSize != 0 || it->slotPtr >= ptrs.pageSize)
+		return false;
+
+	memcpy(&target, rec + it->slotPtr, sizeof(RID));
+	return true;
+}
+
+bool TakeForwarding(TableReorganization& reorg, const RID& rid, RID& home)
+{
+	map<RID, RID, RIDLess>::iterator itr = reorg.forwardedFrom.find(rid);
+	if (itr == reorg.forwardedFrom.end())
+		return false;
+
+	home = itr->second;
+	reorg.forwardedFrom.erase(itr);
+	return true;
+}
+
+bool LoadBatchPage(PF_FileHandle& fh, PageBatch& batch, PageNum pageNum)
+{
+	if (batch.pages.find(pageNum) != batch.pages.end())
+		return true;
+	if (pageNum == 0 || pageNum >= fh.GetNumberOfPages())
+		return false;
+
+	char* rec = (char*)malloc(fh.GetPageSize());
+	if (fh.ReadPage(pageNum, rec) != 0)
+	{
+		free(rec);
+		return false;
+	}
+
+	batch.pages[pageNum] = rec;
+	return true;
+}
+
+RC WriteBatchPages(PF_FileHandle& fh, FreeSpaceMap& fsm, const TableReorganization& reorg, PageBatch& batch, bool isDone)
+{
+	RC result = 0;
+	set<PageNum>::iterator itr;
+	for (itr = batch.dirtyPages.begin(); itr != batch.dirtyPages.end(); ++itr)
+	{
+		// the pages emptied by packing are packed into later, so they take no tuples meanwhile
+		PagePointers ptrs;
+		RetrievePagePointers(ptrs, batch.pages[*itr], fh.GetPageSize());
+		if (reorg.isPacking && !isDone && *itr > reorg.outputPage && *itr < reorg.nextPage)
+			fsm.RemovePage(*itr);
+		else
+			fsm.InsertFreePage(*itr, *ptrs.size_freespace);
+
+		if (fh.WritePage(*itr, batch.pages[*itr]) != 0)
+			result = -1;
+	}
+	if (fsm.FlushDataToFile() != 0)
+		result = -1;
+
+	FreeBatchPages(batch);
+	return result;
+}
+
+void FreeBatchPages(PageBatch& batch)
+{
+	map<PageNum, char*>::iterator pageItr;
+	for (pageItr = batch.pages.begin(); pageItr != batch.pages.end(); ++pageItr)
+		free(pageItr->second);
+	batch.pages.clear();
+	batch.dirtyPages.clear();
+}
+
+bool RedirectTombstone(PF_FileHandle& fh, PageBatch& batch, const RID& home, const RID& from, const RID& to)
+{
+	// the tombstone may have been deleted or updated since it was recorded
+	if (!LoadBatchPage(fh, batch, home.pageNum))
+		return false;
+
+	char* rec = batch.pages[home.pageNum];
+	PagePointers ptrs;
+	RetrievePagePointers(ptrs, rec, fh.GetPageSize());
+	RID target;
+	if (!GetForwardingRID(ptrs, rec, home.slotNum, target) || !IsSameRID(target, from))
+		return false;
+
+	SlotStore* it = ptrs.first;
+	it -= home.slotNum;
+	memcpy(rec + it->slotPtr, &to, sizeof(RID));
+	batch.dirtyPages.insert(home.pageNum);
+
+	return true;
+}
+
+RC CollapseForwarding(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, unsigned maxPages)
+{
+	unsigned numPages = fh.GetNumberOfPages();
+	for (unsigned count = 0; count < maxPages && reorg.nextPage < numPages; ++count, ++reorg.nextPage)
+	{
+		PageNum pageNum = reorg.nextPage;
+		if (!LoadBatchPage(fh, batch, pageNum))
+			return -1;
+
+		PagePointers ptrs;
+		RetrievePagePointers(ptrs, batch.pages[pageNum], fh.GetPageSize());
+		for (unsigned slotNum = 0; slotNum < *ptrs.slots; ++slotNum)
+		{
+			RID home;
+			home.pageNum = pageNum;
+			home.slotNum = slotNum;
+			RID target;
+			if (!GetForwardingRID(ptrs, batch.pages[pageNum], slotNum, target))
+				continue;
+
+			if (CollapseChain(fh, reorg, batch, home, target) != 0)
+				return -1;
+
+			// moving a tuple in may have rearranged the page
+			RetrievePagePointers(ptrs, batch.pages[pageNum], fh.GetPageSize());
+		}
+	}
+
+	// the packing starts over from the first page
+	if (reorg.nextPage >= numPages)
+	{
+		reorg.isPacking = true;
+		reorg.nextPage = 1;
+		reorg.outputPage = 1;
+	}
+
+	return 0;
+}
+
+RC CollapseChain(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, const RID& home, RID target)
+{
+	// free the tombstones on the way to the tuple
+	PagePointers ptrs;
+	SlotStore* it;
+	while (true)
+	{
+		if (IsSameRID(target, home) || !LoadBatchPage(fh, batch, target.pageNum))
+			return 0;	// a broken chain is left as it is
+
+		RetrievePagePointers(ptrs, batch.pages[target.pageNum], fh.GetPageSize());
+		if (target.slotNum >= *ptrs.slots)
+			return 0;
+
+		it = ptrs.first;
+		it -= target.slotNum;
+		if (it->slotSize > 0)
+			break;
+
+		RID next;
+		if (!GetForwardingRID(ptrs, batch.pages[target.pageNum], target.slotNum, next))
+			return 0;	// the tuple was deleted
+
+		*ptrs.size_freespace += sizeof(RID);
+		PushFreeSlot(ptrs, target.slotNum);
+		batch.dirtyPages.insert(target.pageNum);
+		target = next;
+	}
+
+	// the home page needs room for the tuple besides the tombstone's RID, unless the tuple leaves it
+	unsigned tupleSize = it->slotSize;
+	PagePointers homePtrs;
+	RetrievePagePointers(homePtrs, batch.pages[home.pageNum], fh.GetPageSize());
+	SlotStore* homeSlot = homePtrs.first;
+	homeSlot -= home.slotNum;
+	if (target.pageNum != home.pageNum && *homePtrs.size_freespace + sizeof(RID) < tupleSize)
+	{
+		// forward straight to the tuple
+		memcpy(batch.pages[home.pageNum] + homeSlot->slotPtr, &target, sizeof(RID));
+		batch.dirtyPages.insert(home.pageNum);
+		reorg.forwardedFrom[target] = home;
+		return 0;
+	}
+
+	// take the tuple off its page
+	const char* tupleData = batch.pages[target.pageNum] + it->slotPtr;
+	vector<char> tuple(tupleData, tupleData + tupleSize);
+	*ptrs.size_freespace += tupleSize;
+	PushFreeSlot(ptrs, target.slotNum);
+	batch.dirtyPages.insert(target.pageNum);
+	reorg.forwardedFrom.erase(target);
+
+	// and put it in place of the tombstone, as updateTuple() does
+	RetrievePagePointers(homePtrs, batch.pages[home.pageNum], fh.GetPageSize());
+	homeSlot = homePtrs.first;
+	homeSlot -= home.slotNum;
+	homeSlot->slotPtr = GetDeletedSlotPtr(homePtrs);
+	*homePtrs.size_freespace += sizeof(RID);
+	if ((unsigned)((char*)homePtrs.last - (batch.pages[home.pageNum] + *homePtrs.freespace)) < tupleSize)
+	{
+		RearrangePage(homePtrs, batch.pages[home.pageNum]);
+		homeSlot = homePtrs.first;
+		homeSlot -= home.slotNum;
+	}
+	memcpy(batch.pages[home.pageNum] + *homePtrs.freespace, &tuple[0], tupleSize);
+	homeSlot->slotSize = tupleSize;
+	homeSlot->slotPtr = *homePtrs.freespace;
+	*homePtrs.freespace += tupleSize;
+	*homePtrs.size_freespace -= tupleSize;
+	assert(*homePtrs.size_freespace < homePtrs.pageSize);
+	batch.dirtyPages.insert(home.pageNum);
+
+	return 0;
+}
+
+RC PackPages(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, unsigned maxPages, bool& isDone)
+{
+	// read the tuples off a page at a time, and pack them into the output page;
+	// the batch ends with every tuple read packed again
+	PendingTuples pending;
+	for (unsigned count = 0; ; ++count)
+	{
+		for (size_t i = 0; i < pending.tuples.size(); ++i)
+		{
+			if (PackTuple(fh, reorg, batch, pending, i) != 0)
+				return -1;
+		}
+		pending.tuples.clear();
+		pending.data.clear();
+		pending.index.clear();
+
+		if (count == maxPages || reorg.nextPage >= fh.GetNumberOfPages())
+			break;
+		if (ReadPackedPage(fh, reorg, batch, pending) != 0)
+			return -1;
+	}
+
+	isDone = reorg.nextPage >= fh.GetNumberOfPages();
+	return 0;
+}
+
+RC ReadPackedPage(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, PendingTuples& pending)
+{
+	PageNum pageNum = reorg.nextPage++;
+
+	// deallocated pages have no tuples, and stay on the free page list
+	if (fh.IsPageFree(pageNum))
+		return 0;
+
+	if (!LoadBatchPage(fh, batch, pageNum))
+		return -1;
+
+	char* rec = batch.pages[pageNum];
+	PagePointers ptrs;
+	RetrievePagePointers(ptrs, rec, fh.GetPageSize());
+	SlotStore* it = ptrs.first;
+	for (unsigned slotNum = 0; slotNum < *ptrs.slots; ++slotNum, --it)
+	{
+		RID rid;
+		rid.pageNum = pageNum;
+		rid.slotNum = slotNum;
+		RID target;
+		if (it->slotSize > 0)
+		{
+			// the tuple, along with the tombstone forwarding to it
+			PendingTuple tuple;
+			tuple.rid = rid;
+			tuple.offset = pending.data.size();
+			tuple.size = it->slotSize;
+			tuple.isForwarded = TakeForwarding(reorg, rid, tuple.home);
+			pending.data.insert(pending.data.end(), rec + it->slotPtr, rec + it->slotPtr + it->slotSize);
+			pending.index[rid] = pending.tuples.size();
+			pending.tuples.push_back(tuple);
+		}
+		else if (GetForwardingRID(ptrs, rec, slotNum, target))
+		{
+			// a tombstone is dropped; one forwarding to it forwards to its target instead
+			RID home;
+			bool isForwarded = TakeForwarding(reorg, rid, home) && RedirectTombstone(fh, batch, home, rid, target);
+			map<RID, size_t, RIDLess>::iterator pendingItr = pending.index.find(target);
+			if (pendingItr != pending.index.end())
+			{
+				PendingTuple& tuple = pending.tuples[pendingItr->second];
+				if (isForwarded || (tuple.isForwarded && IsSameRID(tuple.home, rid)))
+				{
+					tuple.isForwarded = isForwarded;
+					tuple.home = home;
+				}
+			}
+			else if (isForwarded)
+				reorg.forwardedFrom[target] = home;
+			else
+			{
+				map<RID, RID, RIDLess>::iterator itr = reorg.forwardedFrom.find(target);
+				if (itr != reorg.forwardedFrom.end() && IsSameRID(itr->second, rid))
+					reorg.forwardedFrom.erase(itr);
+			}
+		}
+	}
+
+	// the page is empty until tuples are packed into it
+	SetNewPagePointers(ptrs, rec, fh.GetPageSize());
+	batch.dirtyPages.insert(pageNum);
+
+	return 0;
+}
+
+RC PackTuple(PF_FileHandle& fh, TableReorganization& reorg, PageBatch& batch, PendingTuples& pending, size_t index)
+{
+	// go on to the next output page when the tuple doesn't fit
+	PagePointers ptrs;
+	while (true)
+	{
+		// the output page must not be one still to read: read those first
+		while (reorg.outputPage >= reorg.nextPage)
+		{
+			if (reorg.nextPage < fh.GetNumberOfPages())
+			{
+				if (ReadPackedPage(fh, reorg, batch, pending) != 0)
+					return -1;
+				continue;
+			}
+
+			// the tuples take more pages than they came from (when their slots were fuller);
+			// the page goes at the end, as a free page reused would be behind the output page
+			char* rec = (char*)malloc(fh.GetPageSize());
+			SetNewPagePointers(ptrs, rec, fh.GetPageSize());
+			if (fh.AppendPages(1, rec) != 0)
+			{
+				free(rec);
+				return -1;
+			}
+			batch.pages[fh.GetNumberOfPages() - 1] = rec;
+			reorg.nextPage = fh.GetNumberOfPages();
+		}
+
+		// deallocated pages stay on the free page list
+		if (fh.IsPageFree(reorg.outputPage))
+		{
+			++reorg.outputPage;
+			continue;
+		}
+		if (!LoadBatchPage(fh, batch, reorg.outputPage))
+			return -1;
+
+		RetrievePagePointers(ptrs, batch.pages[reorg.outputPage], fh.GetPageSize());
+		if (*ptrs.size_freespace >= pending.tuples[index].size + sizeof(SlotStore))
+			break;
+		++reorg.outputPage;
+	}
+
+	PendingTuple tuple = pending.tuples[index];
+	RID rid;
+	rid.pageNum = reorg.outputPage;
+	rid.slotNum = AddTupleToPage(ptrs, batch.pages[reorg.outputPage], &pending.data[tuple.offset], tuple.size);
+	batch.dirtyPages.insert(reorg.outputPage);
+	pending.index.erase(tuple.rid);
+
+	// the tombstone forwarding to the tuple follows it
+	if (tuple.isForwarded && RedirectTombstone(fh, batch, tuple.home, tuple.rid, rid))
+		reorg.forwardedFrom[rid] = tuple.home;
+
+	return 0;
+}
+
+RC AppendBatchPages(PF_FileHandle& fh, FreeSpaceMap& fsm, vector<char>& pages)
+{
+	// insert the pages with room left into the free space map, then append them all
+	unsigned pageSize = fh.GetPageSize();
+	unsigned numPages = pages.size() / pageSize;
+	PageNum firstPage = fh.GetNumberOfPages();
+	PagePointers pagePtrs;
+	for (unsigned i = 0; i < numPages; ++i)
+	{
+		RetrievePagePointers(pagePtrs, &pages[i * pageSize], pageSize);
+		fsm.InsertFreePage(firstPage + i, *pagePtrs.size_freespace);
+	}
+
+	RC result = fh.AppendPages(numPages, &pages[0]);
+	pages.clear();
+
+	return result;
+}
+
+string GetFreeSpaceMapFilename(const string& tableFileName)
+{
+	return tableFileName + FREE_SPACE_MAP_SUFFIX;
+}
+
+void IndexCatalog(map<string, TableInfo>& catalog)
+{
+	// compute necessary TableInfo data, and give the tables their ids
+	map<string, TableInfo>::iterator mapItr = catalog.begin();
+	while(mapItr != catalog.end())
+	{
+		mapItr->second.maxInternalTupleSize = ComputeMaxInternalTupleSize(mapItr->second.attribute);
+		catalogTables[InternTableName(mapItr->first)].tableInfo = &mapItr->second;
+		++mapItr;
+	}
+}
+
+bool LoadCatalogSnapshot(map<string, TableInfo>& catalog)
+{
+	// read the whole file at once
+	FILE* file = fopen(CATALOG_SNAPSHOT_FILE_NAME, "rb");
+	if (file == NULL)
+		return false;
+
+	vector<char> fileData;
+	bool isRead = fseek(file, 0, SEEK_END) == 0;
+	long fileSize = isRead ? ftell(file) : -1;
+	if (fileSize >= static_cast<long>(sizeof(CatalogSnapshotHeader)) && fseek(file, 0, SEEK_SET) == 0)
+	{
+		fileData.resize(fileSize);
+		isRead = fread(&fileData[0], fileSize, 1, file) == 1;
+	}
+	else
+		isRead = false;
+	fclose(file);
+	if (!isRead)
+		return false;
+
+	// check that the snapshot is complete and of this version
+	CatalogSnapshotHeader header;
+	memcpy(&header, &fileData[0], sizeof(header));
+	vector<char> data(fileData.begin() + sizeof(header), fileData.end());
+	if (strcmp(header.tag, CATALOG_SNAPSHOT_TAG) != 0
+		|| header.version != CATALOG_SNAPSHOT_VERSION
+		|| header.size != data.size()
+		|| header.checksum != ComputeHash(data.empty() ? NULL : &data[0], data.size()))
+		return false;
+
+	map<string, TableInfo> tables;
+	size_t pos = 0;
+	for (unsigned i = 0; i < header.numTables; ++i)
+	{
+		string tableName;
+		unsigned numAttrs;
+		if (!ReadSnapshotString(data, pos, tableName)
+			|| !ReadSnapshotData(data, pos, &numAttrs, sizeof(numAttrs)))
+			return false;
+
+		TableInfo& tInfo = tables[tableName];
+		for (unsigned j = 0; j < numAttrs; ++j)
+		{
+			string attrName;
+			int attrType;
+			unsigned attrLength;
+			char isValid;
+			if (!ReadSnapshotString(data, pos, attrName)
+				|| !ReadSnapshotData(data, pos, &attrType, sizeof(attrType))
+				|| !ReadSnapshotData(data, pos, &attrLength, sizeof(attrLength))
+				|| !ReadSnapshotData(data, pos, &isValid, sizeof(isValid)))
+				return false;
+
+			tInfo.attribute.push_back(Attribute(attrName, static_cast<AttrType>(attrType), attrLength));
+			tInfo.attrValidity.push_back(isValid != 0);
+		}
+	}
+	if (pos != data.size())
+		return false;
+
+	catalog.swap(tables);
+	return true;
+}
+
+bool SaveCatalogSnapshot(const map<string, TableInfo>& catalog)
+{
+	vector<char> data;
+	map<string, TableInfo>::const_iterator mapItr;
+	for (mapItr = catalog.begin(); mapItr != catalog.end(); ++mapItr)
+	{
+		const vector<Attribute>& attrs = mapItr->second.attribute;
+		unsigned numAttrs = attrs.size();
+		AppendSnapshotString(data, mapItr->first);
+		AppendSnapshotData(data, &numAttrs, sizeof(numAttrs));
+		for (unsigned i = 0; i < numAttrs; ++i)
+		{
+			int attrType = attrs[i].type;
+			unsigned attrLength = attrs[i].length;
+			char isValid = mapItr->second.attrValidity[i] ? 1 : 0;
+			AppendSnapshotString(data, attrs[i].name);
+			AppendSnapshotData(data, &attrType, sizeof(attrType));
+			AppendSnapshotData(data, &attrLength, sizeof(attrLength));
+			AppendSnapshotData(data, &isValid, sizeof(isValid));
+		}
+	}
+
+	CatalogSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	strcpy(header.tag, CATALOG_SNAPSHOT_TAG);
+	header.version = CATALOG_SNAPSHOT_VERSION;
+	header.size = data.size();
+	header.checksum = ComputeHash(data.empty() ? NULL : &data[0], data.size());
+	header.numTables = catalog.size();
+
+	// write a new file and rename it over the old one; a crash leaves one or the other
+	string newFileName = string(CATALOG_SNAPSHOT_FILE_NAME) + ".new";
+	FILE* file = fopen(newFileName.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1
+		&& (data.empty() || fwrite(&data[0], data.size(), 1, file) == 1)
+		&& fflush(file) == 0
+		&& fsync(fileno(file)) == 0;
+	if (fclose(file) != 0)
+		isWritten = false;
+
+	if (!isWritten || rename(newFileName.c_str(), CATALOG_SNAPSHOT_FILE_NAME) != 0)
+	{
+		remove(newFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void RemoveCatalogSnapshot()
+{
+	remove(CATALOG_SNAPSHOT_FILE_NAME);
+}
+
+void AppendSnapshotData(vector<char>& data, const void* value, size_t size)
+{
+	const char* bytes = reinterpret_cast<const char*>(value);
+	data.insert(data.end(), bytes, bytes + size);
+}
+
+void AppendSnapshotString(vector<char>& data, const string& value)
+{
+	unsigned length = value.size();
+	AppendSnapshotData(data, &length, sizeof(length));
+	AppendSnapshotData(data, value.data(), length);
+}
+
+bool ReadSnapshotData(const vector<char>& data, size_t& pos, void* value, size_t size)
+{
+	if (data.size() - pos < size)
+		return false;
+
+	memcpy(value, &data[0] + pos, size);
+	pos += size;
+	return true;
+}
+
+bool ReadSnapshotString(const vector<char>& data, size_t& pos, string& value)
+{
+	unsigned length;
+	if (!ReadSnapshotData(data, pos, &length, sizeof(length)) || data.size() - pos < length)
+		return false;
+
+	value.assign(&data[0] + pos, length);
+	pos += length;
+	return true;
+}
+
+bool AttributePositionLess(const pair<unsigned, Attribute>& lhs, const pair<unsigned, Attribute>& rhs)
+{
+	return lhs.first < rhs.first;
+}
+
+
+bool FindValidAttribute(const TableInfo& tableInfo, const string& attrName, unsigned& attrIndex)
+{
+	// a dropped attribute may have been added again; only the valid one is found
+	for (unsigned i = 0; i < tableInfo.attribute.size(); ++i)
+	{
+		if (tableInfo.attrValidity[i] && tableInfo.attribute[i].name == attrName)
+		{
+			attrIndex = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool HasDroppedAttributes(const TableInfo& tableInfo)
+{
+	for (unsigned i = 0; i < tableInfo.attrValidity.size(); ++i)
+	{
+		if (!tableInfo.attrValidity[i])
+			return true;
+	}
+
+	return false;
+}
+
+RC CheckTableFormat(PF_FileHandle& fileHandle)
+{
+	// tables written before the tuples had their schema version would be misread;
+	// they are refused, and have to be created and loaded again
+	PageDirectory pDir(fileHandle);
+	if (pDir.LoadDataFromFile() != 0)
+		return -1;
+	if (pDir.GetFormatVersion() != TABLE_FORMAT_VERSION)
+		return RM_OLD_TABLE_FORMAT;
+
+	return 0;
+}
+
+const TableInfo& GetTupleSchema(const TableInfo& tableInfo, vector<TableInfo>& schemas, unsigned version)
+{
+	// attributes are only ever appended (dropped ones keep their position), so the
+	// schema a tuple was written in is the first 'version' attributes, all valid
+	assert(version <= tableInfo.attribute.size());
+	if (version >= schemas.size())
+		schemas.resize(version + 1);
+
+	TableInfo& schema = schemas[version];
+	if (schema.attribute.size() != version)
+	{
+		schema.attribute.assign(tableInfo.attribute.begin(), tableInfo.attribute.begin() + version);
+		schema.attrValidity.assign(version, true);
+		schema.maxInternalTupleSize = ComputeMaxInternalTupleSize(schema.attribute);
+	}
+
+	return schema;
+}
+
+unsigned GetMaxStoredTupleSize(const TableInfo& tableInfo)
+{
+	return TUPLE_SCHEMA_VERSION_SIZE + GetMaxInternalTupleSize(tableInfo);
+}
+
+void ExternalToStoredTupleFormat(const TableInfo& tableInfo, vector<TableInfo>& schemas, const void* data, char* stored, unsigned& storedSize)
+{
+	// a tuple is stored in the newest schema version: its number of attributes
+	unsigned version = tableInfo.attribute.size();
+	memcpy(stored, &version, TUPLE_SCHEMA_VERSION_SIZE);
+
+	if (!HasDroppedAttributes(tableInfo))
+		ExternalToInternalTupleFormat(tableInfo, data, stored + TUPLE_SCHEMA_VERSION_SIZE, storedSize);
+	else
+	{
+		// the data has no value for the dropped attributes; they store their default
+		vector<char> schemaData;
+		char defaultValue[sizeof(int)];
+		const char* dataPtr = reinterpret_cast<const char*>(data);
+		for (unsigned i = 0; i < version; ++i)
+		{
+			if (tableInfo.attrValidity[i])
+			{
+				unsigned attrSize = GetExternalAttributeSize(tableInfo.attribute[i], dataPtr);
+				schemaData.insert(schemaData.end(), dataPtr, dataPtr + attrSize);
+				dataPtr += attrSize;
+			}
+			else
+			{
+				unsigned attrSize = GetDefaultAttribute(tableInfo.attribute[i], defaultValue);
+				schemaData.insert(schemaData.end(), defaultValue, defaultValue + attrSize);
+			}
+		}
+
+		const TableInfo& schema = GetTupleSchema(tableInfo, schemas, version);
+		ExternalToInternalTupleFormat(schema, &schemaData[0], stored + TUPLE_SCHEMA_VERSION_SIZE, storedSize);
+	}
+
+	storedSize += TUPLE_SCHEMA_VERSION_SIZE;
+}
+
+void StoredToExternalTupleFormat(const TableInfo& tableInfo, vector<TableInfo>& schemas, const char* stored, void* data, unsigned& dataSize)
+{
+	// a tuple stored after the table info was taken has attributes beyond it, at the end
+	unsigned version;
+	memcpy(&version, stored, TUPLE_SCHEMA_VERSION_SIZE);
+	version = min(version, static_cast<unsigned>(tableInfo.attribute.size()));
+	const char* tuple = stored + TUPLE_SCHEMA_VERSION_SIZE;
+
+	if (version == tableInfo.attribute.size() && !HasDroppedAttributes(tableInfo))
+	{
+		InternalToExternalTupleFormat(tableInfo, tuple, data, dataSize);
+		return;
+	}
+
+	// skip the dropped attributes, and fill in the defaults of those added since
+	const TableInfo& schema = GetTupleSchema(tableInfo, schemas, version);
+	char* dataPtr = reinterpret_cast<char*>(data);
+	dataSize = 0;
+	for (unsigned i = 0; i < tableInfo.attribute.size(); ++i)
+	{
+		if (!tableInfo.attrValidity[i])
+			continue;
+
+		unsigned attrSize;
+		if (i < version)
+			GetTupleAttribute(schema, tuple, i, dataPtr + dataSize, attrSize);
+		else
+			attrSize = GetDefaultAttribute(tableInfo.attribute[i], dataPtr + dataSize);
+		dataSize += attrSize;
+	}
+}
+
+void GetStoredTupleAttribute(const TableInfo& tableInfo, vector<TableInfo>& schemas, const char* stored, unsigned attrIndex, void* data, unsigned& dataSize)
+{
+	unsigned version;
+	memcpy(&version, stored, TUPLE_SCHEMA_VERSION_SIZE);
+	version = min(version, static_cast<unsigned>(tableInfo.attribute.size()));
+
+	// the attribute was added after the tuple was stored
+	if (attrIndex >= version)
+	{
+		dataSize = GetDefaultAttribute(tableInfo.attribute[attrIndex], data);
+		return;
+	}
+
+	const TableInfo& schema = GetTupleSchema(tableInfo, schemas, version);
+	GetTupleAttribute(schema, stored + TUPLE_SCHEMA_VERSION_SIZE, attrIndex, data, dataSize);
+}
+
+unsigned GetExternalAttributeSize(const Attribute& attr, const char* data)
+{
+	if (attr.type == TypeVarChar)
+	{
+		unsigned length;
+		memcpy(&length, data, TYPE_VARCHAR_SIZE);
+		return TYPE_VARCHAR_SIZE + length;
+	}
+	else if (attr.type == TypeReal)
+		return sizeof(float);
+
+	return TYPE_INT_SIZE;
+}
+
+unsigned GetDefaultAttribute(const Attribute& attr, void* data)
+{
+	// zero, or the empty string
+	if (attr.type == TypeVarChar)
+	{
+		unsigned length = 0;
+		memcpy(data, &length, TYPE_VARCHAR_SIZE);
+		return TYPE_VARCHAR_SIZE;
+	}
+	else if (attr.type == TypeReal)
+	{
+		float value = 0;
+		memcpy(data, &value, sizeof(value));
+		return sizeof(value);
+	}
+
+	int value = 0;
+	memcpy(data, &value, TYPE_INT_SIZE);
+	return TYPE_INT_SIZE;
+}
@@ -0,0 +1,204 @@
+
+#ifndef _rm_h_
+#define _rm_h_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+
+#include "pf.h"
+#include "PageUtility.h"
+
+using namespace std;
+
+
+// Return code
+typedef int RC;
+
+
+// Record ID
+typedef struct
+{
+  unsigned pageNum;
+  unsigned slotNum;
+} RID;
+
+
+// Attribute
+typedef enum { TypeInt = 0, TypeReal, TypeVarChar } AttrType;
+
+typedef unsigned AttrLength;
+
+struct Attribute {
+    string   name;     // attribute name
+    AttrType type;     // attribute type
+    AttrLength length; // attribute length
+
+    Attribute() : type(TypeInt), length(0) {}
+    Attribute(const string& attrName, AttrType attrType, AttrLength attrLength)
+        : name(attrName), type(attrType), length(attrLength) {}
+};
+
+
+// Comparison Operator
+typedef enum { EQ_OP = 0,  // =
+           LT_OP,      // <
+           GT_OP,      // >
+           LE_OP,      // <=
+           GE_OP,      // >=
+           NE_OP,      // !=
+           NO_OP       // no condition
+} CompOp;
+
+
+// Cached catalog entry of a table; dropped attributes keep their position,
+// marked invalid
+struct TableInfo
+{
+	vector<Attribute> attribute;
+	vector<bool> attrValidity;
+	unsigned maxInternalTupleSize;
+};
+
+
+// Interned table name (see RM::openTable())
+typedef unsigned TableId;
+
+
+# define RM_EOF (-1)  // end of a scan operator
+# define RM_OLD_TABLE_FORMAT (-2)  // the table file is of an older format; create the table again
+
+// RM_ScanIterator is an iteratr to go through records
+// The way to use it is like the following:
+//  RM_ScanIterator rmScanIterator;
+//  rm.open(..., rmScanIterator);
+//  while (rmScanIterator(rid, data) != RM_EOF) {
+//    process the data;
+//  }
+//  rmScanIterator.close();
+
+class RM;
+
+class RM_ScanIterator {
+public:
+  RM_ScanIterator() : _pFileHandle(NULL) {};
+  ~RM_ScanIterator() {};
+
+  // "data" follows the same format as RM::insertTuple()
+  RC getNextTuple(RID &rid, void *data);
+  RC close();
+
+private:
+  bool Compare(const string& attrData, const string& compValue) const;
+  bool Compare(const int attrData, const int compValue) const;
+  bool Compare(const float attrData, const float compValue) const;
+
+  TableInfo _tableInfo;
+  PF_FileHandle* _pFileHandle;
+  PageNum _currPageNum;
+  vector<char> _pageData;		// the current page, the size of the table's pages
+  PagePointers _pagePtrs;
+  SlotStore* _slotPtr;			// next slot to return; NULL if the table has no data pages
+  vector<unsigned> _attrPositions;	// projected attributes
+  CompOp _compOp;
+  AttrType _attrType;
+  unsigned _compAttrPosition;
+  const void* _compValue;
+  vector<TableInfo> _tupleSchemas;	// by schema version of the tuples read
+
+  friend class RM;
+};
+
+
+// Record Manager
+class RM
+{
+public:
+  static RM* Instance();
+
+  RC createTable(const string tableName, const vector<Attribute> &attrs);
+
+  RC createTable(const string tableName, const vector<Attribute> &attrs, bool isCompressed);
+
+  // Create a table with pages of pageSize bytes (4K to 64K, see PF_Manager::CreateFile()):
+  // large pages for tables read by scans, small ones for tables updated a tuple at a time
+  RC createTable(const string tableName, const vector<Attribute> &attrs, const unsigned pageSize, bool isCompressed);
+
+  RC deleteTable(const string tableName);
+
+  RC getAttributes(const string tableName, vector<Attribute> &attrs);
+
+  // Look a table up once, for the TableId overloads below; opens its file, and
+  // returns RM_OLD_TABLE_FORMAT when the file is of an older format
+  RC openTable(const string tableName, TableId &tableId);
+
+  //  Format of the data passed into the function is the following:
+  //  1) data is a concatenation of values of the attributes
+  //  2) For int and real: use 4 bytes to store the value;
+  //     For varchar: use 4 bytes to store the length of characters, then store the actual characters.
+  //  !!!The same format is used for updateTuple(), the returned data of readTuple(), and readAttribute()
+  RC insertTuple(const string tableName, const void *data, RID &rid);
+  RC insertTuple(const TableId tableId, const void *data, RID &rid);
+
+  // Insert a batch of tuples, filling a page at a time
+  RC insertTuples(const string tableName, const vector<const void*> &tuples, vector<RID> &rids);
+  RC insertTuples(const TableId tableId, const vector<const void*> &tuples, vector<RID> &rids);
+
+  RC deleteTuples(const string tableName);
+
+  RC deleteTuple(const string tableName, const RID &rid);
+  RC deleteTuple(const TableId tableId, const RID &rid);
+
+  // Assume the rid does not change after update
+  RC updateTuple(const string tableName, const void *data, const RID &rid);
+  RC updateTuple(const TableId tableId, const void *data, const RID &rid);
+
+  RC readTuple(const string tableName, const RID &rid, void *data);
+  RC readTuple(const TableId tableId, const RID &rid, void *data);
+
+  RC readAttribute(const string tableName, const RID &rid, const string attributeName, void *data);
+  RC readAttribute(const TableId tableId, const RID &rid, const string attributeName, void *data);
+
+  RC reorganizePage(const string tableName, const unsigned pageNumber);
+
+  // scan returns an iterator to allow the caller to go through the results one by one.
+  RC scan(const string tableName,
+      const string conditionAttribute,
+      const CompOp compOp,                  // comparision type such as "<" and "="
+      const void *value,                    // used in the comparison
+      const vector<string> &attributeNames, // a list of projected attributes
+      RM_ScanIterator &rm_ScanIterator);
+
+
+// Extra credit
+public:
+  RC dropAttribute(const string tableName, const string attributeName);
+
+  RC addAttribute(const string tableName, const Attribute attr);
+
+  RC reorganizeTable(const string tableName);
+
+  // Collapse the forwarding chains of up to maxPages pages; once they are all
+  // collapsed, pack the whole table in the same call, and set isDone
+  RC reorganizeTable(const string tableName, const unsigned maxPages, bool &isDone);
+
+
+protected:
+  RM();
+  ~RM();
+
+  bool loadAttributeCatalog();
+  void getAttributeCatalogAttributes(vector<Attribute>& attrs);
+  bool tableExists(const string& tableName) const;
+  bool getTableInfo(const string& tableName, TableInfo& tableInfo);
+  bool getSequentialScanIterator(const TableInfo& tableInfo, const string& tableName, RM_ScanIterator& rm_ScanIterator) const;
+
+private:
+  static RM *_rm;
+  static PF_Manager* pf;
+
+  map<string, TableInfo> _catalogAttrTable;	// cached attribute catalog, by table name
+};
+
+#endif
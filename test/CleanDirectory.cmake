@@ -0,0 +1,3 @@
+# empties the working directory of a test: cmake -DDIRECTORY=<dir> -P CleanDirectory.cmake
+file(REMOVE_RECURSE ${DIRECTORY})
+file(MAKE_DIRECTORY ${DIRECTORY})
@@ -0,0 +1,114 @@
+// Crash recovery of the paged file layer: a committed operation survives a
+// crash, an uncommitted one is undone, and an aborted one is undone right away.
+// Pages written whole by WritePages() commit with it.
+
+#include "pf.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+static const char FILE_NAME[] = "pf_recovery_test.pf";
+static const char LOG_FILE_NAME[] = "pf_recovery_test.log";
+
+static PF_FileHandle* sharedHandle = NULL;
+
+static bool IsFilled(const char* data, char value)
+{
+	for (unsigned i = 0; i < PF_PAGE_SIZE; ++i)
+	{
+		if (data[i] != value)
+			return false;
+	}
+	return true;
+}
+
+static void* WriteUncommitted(void*)
+{
+	// the operation of this thread never commits
+	char data[PF_PAGE_SIZE];
+	memset(data, 'b', PF_PAGE_SIZE);
+	CHECK(sharedHandle->WritePage(2, data) == 0);
+	return NULL;
+}
+
+int main()
+{
+	PF_Manager* pf = PF_Manager::Instance();
+	remove(FILE_NAME);
+	remove(LOG_FILE_NAME);
+
+	char data[PF_PAGE_SIZE];
+	PF_FileHandle handle;
+	CHECK(pf->CreateFile(FILE_NAME) == 0);
+	CHECK(pf->OpenFile(FILE_NAME, handle) == 0);
+	memset(data, '0', PF_PAGE_SIZE);
+	for (unsigned i = 0; i < 4; ++i)
+		CHECK(handle.AppendPage(data) == 0);
+	CHECK(pf->CloseFile(handle) == 0);
+
+	pid_t pid = fork();
+	CHECK(pid >= 0);
+	if (pid == 0)
+	{
+		CHECK(pf->OpenLog(LOG_FILE_NAME) == 0);
+		CHECK(pf->OpenFile(FILE_NAME, handle) == 0);
+		CHECK(handle.EnableLogging() == 0);
+
+		// an aborted operation is undone, appended pages included
+		memset(data, 'c', PF_PAGE_SIZE);
+		CHECK(handle.WritePage(3, data) == 0);
+		CHECK(handle.AppendPage(data) == 0);
+		CHECK(pf->Abort() == 0);
+		CHECK(handle.GetNumberOfPages() == 4);
+		CHECK(handle.ReadPage(3, data) == 0);
+		CHECK(IsFilled(data, '0'));
+
+		// whole pages are not undone; they commit right away
+		memset(data, 'd', PF_PAGE_SIZE);
+		CHECK(handle.WritePages(3, 1, data) == 0);
+		CHECK(pf->Abort() == 0);
+		CHECK(handle.ReadPage(3, data) == 0);
+		CHECK(IsFilled(data, 'd'));
+
+		// another thread's operation does not commit along with this one
+		sharedHandle = &handle;
+		pthread_t thread;
+		CHECK(pthread_create(&thread, NULL, WriteUncommitted, NULL) == 0);
+		CHECK(pthread_join(thread, NULL) == 0);
+		memset(data, 'a', PF_PAGE_SIZE);
+		CHECK(handle.WritePage(1, data) == 0);
+		CHECK(pf->Commit() == 0);
+
+		// the uncommitted page reaches the file too; then crash
+		CHECK(handle.Sync() == 0);
+		_exit(0);
+	}
+	int status = 0;
+	CHECK(waitpid(pid, &status, 0) == pid);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// recovery redoes the committed page and undoes the uncommitted one
+	CHECK(pf->OpenLog(LOG_FILE_NAME) == 0);
+	CHECK(pf->OpenFile(FILE_NAME, handle) == 0);
+	CHECK(handle.GetNumberOfPages() == 4);
+	CHECK(handle.ReadPage(1, data) == 0);
+	CHECK(IsFilled(data, 'a'));
+	CHECK(handle.ReadPage(2, data) == 0);
+	CHECK(IsFilled(data, '0'));
+	CHECK(handle.ReadPage(3, data) == 0);
+	CHECK(IsFilled(data, 'd'));
+	CHECK(pf->CloseFile(handle) == 0);
+	CHECK(pf->CloseLog() == 0);
+
+	remove(FILE_NAME);
+	remove(LOG_FILE_NAME);
+	printf("ok\n");
+	return 0;
+}
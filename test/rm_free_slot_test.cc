@@ -0,0 +1,106 @@
+// Deleted slots are reused: a tuple inserted after deletes takes a freed
+// slot of the page instead of growing its slot directory.
+
+#include "rm.h"
+#include "AttrCatalogUtility.h"
+#include "FileSystemUtility.h"
+#include "TableUtility.h"
+#include "TupleItem.h"
+#include "TupleUtility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+static const char TABLE_NAME[] = "free_slot";
+
+static TupleItem MakeTuple(int id)
+{
+	return TupleItem(id) + TupleItem(string(20, 'a' + id % 26));
+}
+
+static unsigned CountTuples()
+{
+	vector<string> attributeNames;
+	attributeNames.push_back("id");
+	RM_ScanIterator iterator;
+	CHECK(RM::Instance()->scan(TABLE_NAME, "", NO_OP, NULL, attributeNames, iterator) == 0);
+
+	RID rid;
+	char data[PF_PAGE_SIZE];
+	unsigned count = 0;
+	while (iterator.getNextTuple(rid, data) != RM_EOF)
+		++count;
+	CHECK(iterator.close() == 0);
+
+	return count;
+}
+
+int main()
+{
+	RM* rm = RM::Instance();
+	vector<Attribute> attrs;
+	attrs.push_back(Attribute("id", TypeInt, 4));
+	attrs.push_back(Attribute("name", TypeVarChar, 30));
+	CHECK(rm->createTable(TABLE_NAME, attrs) == 0);
+
+	// a page of tuples
+	vector<RID> rids(10);
+	for (unsigned i = 0; i < rids.size(); ++i)
+	{
+		CHECK(rm->insertTuple(TABLE_NAME, MakeTuple(i).GetData(), rids[i]) == 0);
+		CHECK(rids[i].pageNum == rids[0].pageNum);
+	}
+
+	// a slot is freed only once
+	set<unsigned> freedSlots;
+	for (unsigned i = 2; i < rids.size(); i += 3)
+	{
+		CHECK(rm->deleteTuple(TABLE_NAME, rids[i]) == 0);
+		CHECK(rm->deleteTuple(TABLE_NAME, rids[i]) != 0);
+		freedSlots.insert(rids[i].slotNum);
+	}
+	CHECK(CountTuples() == rids.size() - freedSlots.size());
+
+	// the next inserts take the freed slots, and the tuples read back
+	unsigned numFreed = freedSlots.size();
+	for (unsigned i = 0; i < numFreed; ++i)
+	{
+		RID rid;
+		CHECK(rm->insertTuple(TABLE_NAME, MakeTuple(100 + i).GetData(), rid) == 0);
+		CHECK(rid.pageNum == rids[0].pageNum);
+		CHECK(freedSlots.erase(rid.slotNum) == 1);
+
+		char data[PF_PAGE_SIZE];
+		CHECK(rm->readTuple(TABLE_NAME, rid, data) == 0);
+		CHECK(ExtractInt(data) == static_cast<int>(100 + i));
+	}
+	CHECK(CountTuples() == rids.size());
+
+	// with none left, the slot directory grows
+	RID rid;
+	CHECK(rm->insertTuple(TABLE_NAME, MakeTuple(200).GetData(), rid) == 0);
+	CHECK(rid.pageNum == rids[0].pageNum && rid.slotNum == rids.size());
+
+	// deleting the table removes its file and catalog rows, but keeps the catalog
+	CHECK(rm->deleteTable(TABLE_NAME) == 0);
+	CHECK(!DoesFileExist(getTableFilename(TABLE_NAME)));
+	CHECK(DoesFileExist(getTableFilename(CATALOG_ATTRIBUTES_TABLE_NAME)));
+	vector<Attribute> deletedAttrs;
+	CHECK(rm->getAttributes(TABLE_NAME, deletedAttrs) != 0);
+	TupleItem tableName = TupleItem(string(TABLE_NAME));
+	vector<string> attributeNames;
+	RM_ScanIterator iterator;
+	CHECK(rm->scan(CATALOG_ATTRIBUTES_TABLE_NAME, CATALOG_TABLE_NAME_STRING, EQ_OP, tableName.GetData(), attributeNames,
+		iterator) == 0);
+	CHECK(iterator.getNextTuple(rid, NULL) == RM_EOF);
+	CHECK(iterator.close() == 0);
+	CHECK(rm->createTable(TABLE_NAME, attrs) == 0);
+	CHECK(CountTuples() == 0);
+
+	printf("ok\n");
+	return 0;
+}
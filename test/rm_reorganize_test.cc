@@ -0,0 +1,112 @@
+// reorganizeTable() a few pages at a time: the RIDs stay valid while the
+// forwarding chains are collapsed, updates between the calls are kept, and
+// the packed table has the same tuples in fewer pages.
+
+#include "rm.h"
+#include "TupleItem.h"
+#include "TupleUtility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+static const char TABLE_NAME[] = "reorganize";
+static const int NUM_TUPLES = 1000;
+
+static TupleItem MakeTuple(int id, const string& name)
+{
+	return TupleItem(id) + TupleItem(name);
+}
+
+static void CheckTuple(const RID& rid, int id, const string& name)
+{
+	char data[PF_PAGE_SIZE];
+	CHECK(RM::Instance()->readTuple(TABLE_NAME, rid, data) == 0);
+	CHECK(ExtractInt(data) == id);
+	CHECK(ExtractString(data + sizeof(int)) == name);
+}
+
+static void CheckScan(const map<int, string>& expected, PageNum& maxPageNum)
+{
+	vector<string> attributeNames;
+	attributeNames.push_back("id");
+	attributeNames.push_back("name");
+	RM_ScanIterator iterator;
+	CHECK(RM::Instance()->scan(TABLE_NAME, "", NO_OP, NULL, attributeNames, iterator) == 0);
+
+	map<int, string> found;
+	RID rid;
+	char data[PF_PAGE_SIZE];
+	maxPageNum = 0;
+	while (iterator.getNextTuple(rid, data) != RM_EOF)
+	{
+		CHECK(found.insert(make_pair(ExtractInt(data), ExtractString(data + sizeof(int)))).second);
+		maxPageNum = max(maxPageNum, rid.pageNum);
+	}
+	CHECK(iterator.close() == 0);
+	CHECK(found == expected);
+}
+
+int main()
+{
+	RM* rm = RM::Instance();
+	vector<Attribute> attrs;
+	attrs.push_back(Attribute("id", TypeInt, 4));
+	attrs.push_back(Attribute("name", TypeVarChar, 200));
+	CHECK(rm->createTable(TABLE_NAME, attrs) == 0);
+
+	vector<RID> rids(NUM_TUPLES);
+	map<int, string> expected;
+	for (int i = 0; i < NUM_TUPLES; ++i)
+	{
+		expected[i] = string(20, 'a' + i % 26);
+		CHECK(rm->insertTuple(TABLE_NAME, MakeTuple(i, expected[i]).GetData(), rids[i]) == 0);
+	}
+
+	// holes, and tuples grown off their full pages
+	for (int i = 0; i < NUM_TUPLES; i += 2)
+	{
+		CHECK(rm->deleteTuple(TABLE_NAME, rids[i]) == 0);
+		expected.erase(i);
+	}
+	for (int i = 1; i < NUM_TUPLES; i += 4)
+	{
+		expected[i] = string(150, 'A' + i % 26);
+		CHECK(rm->updateTuple(TABLE_NAME, MakeTuple(i, expected[i]).GetData(), rids[i]) == 0);
+	}
+	PageNum maxPageNum = 0;
+	CheckScan(expected, maxPageNum);
+	PageNum maxPageNumBefore = maxPageNum;
+
+	// the chains are collapsed a couple of pages per call; the RIDs stay valid
+	// and the table can be updated in between, until the call that packs it
+	bool isDone = false;
+	unsigned numCalls = 0;
+	for (int i = 3; !isDone; i += 4)
+	{
+		if (i < NUM_TUPLES)
+		{
+			expected[i] = string(150 + i % 40, 'a' + i % 26);
+			CHECK(rm->updateTuple(TABLE_NAME, MakeTuple(i, expected[i]).GetData(), rids[i]) == 0);
+		}
+		for (int j = 1; j < NUM_TUPLES; j += 2)
+			CheckTuple(rids[j], j, expected[j]);
+
+		CHECK(rm->reorganizeTable(TABLE_NAME, 2, isDone) == 0);
+		++numCalls;
+	}
+	CHECK(numCalls > 1);
+
+	CheckScan(expected, maxPageNum);
+	CHECK(maxPageNum < maxPageNumBefore);
+
+	// a table already packed is packed again in one call
+	CHECK(rm->reorganizeTable(TABLE_NAME) == 0);
+	CheckScan(expected, maxPageNum);
+
+	printf("ok\n");
+	return 0;
+}